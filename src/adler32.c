@@ -0,0 +1,150 @@
+//
+//  adler32.c
+//  nflate
+//
+//  Copyright (c) 2020 David Kopec
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include <stdbool.h>
+#include "adler32.h"
+#include "thread.h"
+
+// Based on RFC 1950
+// https://tools.ietf.org/html/rfc1950
+
+#define BASE 65521 // largest prime below 65536
+#define NMAX 5552 // most bytes that can be summed before the second sum could overflow 32 bits
+#define BLOCK_SIZE 32 // bytes summed by each step of the vector loop
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#if defined(__GNUC__) || defined(__clang__)
+#define ADLER32_SSSE3
+#define SSSE3_TARGET __attribute__((target("ssse3")))
+#include <cpuid.h>
+#include <immintrin.h>
+#elif defined(_MSC_VER)
+#define ADLER32_SSSE3
+#define SSSE3_TARGET
+#include <intrin.h>
+#endif
+#endif
+
+static bool use_ssse3 = false;
+static thread_once_flag setup_once = THREAD_ONCE_INIT;
+
+#ifdef ADLER32_SSSE3
+static bool cpu_has_ssse3(void) {
+    unsigned int ecx = 0;
+#if defined(_MSC_VER) && !defined(__clang__)
+    int registers[4];
+    __cpuid(registers, 1);
+    ecx = (unsigned int)registers[2];
+#else
+    unsigned int eax, ebx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return false;
+    }
+#endif
+    return ecx & (1u << 9);
+}
+
+// add up the four 32-bit lanes of *v*
+SSSE3_TARGET static inline uint32_t sum_lanes(__m128i v) {
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+    return (uint32_t)_mm_cvtsi128_si32(v);
+}
+
+// Sum 32 bytes at a time, as Chromium's zlib does: the first sum is a sum of
+// absolute differences against zero, and each byte's share of the second sum
+// is its weight (32 for the first byte of a block down to 1 for the last)
+// times the byte, done with multiply-adds; the first sum from before each
+// block counts 32 times more toward the second. *length* must be a multiple
+// of BLOCK_SIZE.
+SSSE3_TARGET static void adler32_ssse3(uint32_t *s1, uint32_t *s2, const uint8_t *data, size_t length) {
+    const __m128i weights_high = _mm_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17);
+    const __m128i weights_low = _mm_setr_epi8(16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+    const __m128i ones = _mm_set1_epi16(1);
+    const __m128i zero = _mm_setzero_si128();
+    size_t blocks = length / BLOCK_SIZE;
+    while (blocks > 0) {
+        size_t n = (blocks < NMAX / BLOCK_SIZE) ? blocks : NMAX / BLOCK_SIZE;
+        blocks -= n;
+        __m128i earlier_sums = _mm_cvtsi32_si128((int)(*s1 * n)); // the first sum before each block, added up
+        __m128i v_s1 = zero;
+        __m128i v_s2 = _mm_cvtsi32_si128((int)*s2);
+        do {
+            __m128i high = _mm_loadu_si128((const __m128i *)data);
+            __m128i low = _mm_loadu_si128((const __m128i *)(data + 16));
+            earlier_sums = _mm_add_epi32(earlier_sums, v_s1);
+            v_s1 = _mm_add_epi32(v_s1, _mm_add_epi32(_mm_sad_epu8(high, zero), _mm_sad_epu8(low, zero)));
+            v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_maddubs_epi16(high, weights_high), ones));
+            v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_maddubs_epi16(low, weights_low), ones));
+            data += BLOCK_SIZE;
+        } while (--n > 0);
+        v_s2 = _mm_add_epi32(v_s2, _mm_slli_epi32(earlier_sums, 5));
+        *s1 = (*s1 + sum_lanes(v_s1)) % BASE;
+        *s2 = sum_lanes(v_s2) % BASE;
+    }
+}
+#endif
+
+static void setup(void) {
+#ifdef ADLER32_SSSE3
+    use_ssse3 = cpu_has_ssse3();
+#endif
+}
+
+uint32_t adler32_init(void) {
+    return 1;
+}
+
+uint32_t adler32_update(uint32_t adler, const uint8_t *data, size_t length) {
+    thread_once(&setup_once, setup);
+    uint32_t s1 = adler & 0xFFFF;
+    uint32_t s2 = adler >> 16;
+
+#ifdef ADLER32_SSSE3
+    if (use_ssse3 && length >= BLOCK_SIZE) {
+        size_t blocks = length & ~(size_t)(BLOCK_SIZE - 1);
+        adler32_ssse3(&s1, &s2, data, blocks);
+        data += blocks;
+        length -= blocks;
+    }
+#endif
+
+    // the sums are only reduced every NMAX bytes
+    while (length > 0) {
+        size_t n = (length < NMAX) ? length : NMAX;
+        length -= n;
+        for (; n >= 8; n -= 8) {
+            s1 += data[0]; s2 += s1;
+            s1 += data[1]; s2 += s1;
+            s1 += data[2]; s2 += s1;
+            s1 += data[3]; s2 += s1;
+            s1 += data[4]; s2 += s1;
+            s1 += data[5]; s2 += s1;
+            s1 += data[6]; s2 += s1;
+            s1 += data[7]; s2 += s1;
+            data += 8;
+        }
+        for (; n > 0; n--) {
+            s1 += *data++;
+            s2 += s1;
+        }
+        s1 %= BASE;
+        s2 %= BASE;
+    }
+    return (s2 << 16) | s1;
+}
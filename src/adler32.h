@@ -1,5 +1,5 @@
 //
-//  binarytree.h
+//  adler32.h
 //  nflate
 //
 //  Copyright (c) 2020 David Kopec
@@ -16,23 +16,18 @@
 //  See the License for the specific language governing permissions and
 //  limitations under the License.
 
-#ifndef binarytree_h
-#define binarytree_h
+#ifndef adler32_h
+#define adler32_h
 
 #include <stdint.h>
+#include <stddef.h>
 
-// Binary Tree
-typedef struct bt {
-    uint16_t value;
-    struct bt *left; // 0
-    struct bt *right; // 1
-} bt;
+// Incremental Adler-32 as used by zlib (RFC 1950 section 8)
+//  uint32_t adler = adler32_init();
+//  adler = adler32_update(adler, data, length); // as many times as needed
+// Unlike CRC-32 there is no final step. Large updates use SSSE3 on x86
+// processors that support it.
+uint32_t adler32_init(void);
+uint32_t adler32_update(uint32_t adler, const uint8_t *data, size_t length);
 
-// Create a binary tree node on the heap with null children and *value* value
-// Return a pointer to it
-bt *bt_create(uint16_t value);
-
-// Free a binary tree node and all of its children recursively
-void bt_free(bt *node);
-
-#endif /* binarytree_h */
+#endif /* adler32_h */
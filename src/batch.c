@@ -0,0 +1,172 @@
+//
+//  batch.c
+//  nflate
+//
+//  Copyright (c) 2020 David Kopec
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include <stdlib.h>
+#include "batch.h"
+#include "gzipfile.h"
+#include "threadpool.h"
+
+#define TRAILER_LENGTH 8
+
+// the items a worker inflates, one after another, with its own context
+typedef struct {
+    nflate_context *context;
+    gzip_batch_item *items;
+    size_t count;
+} batch_slice;
+
+struct gzip_batch {
+    threadpool *pool; // NULL when everything is done on the calling thread
+    int num_slices;
+    batch_slice *slices;
+};
+
+gzip_batch *gzip_batch_create(int num_threads) {
+    if (num_threads < 1) {
+        num_threads = 1;
+    }
+    gzip_batch *batch = calloc(1, sizeof(gzip_batch));
+    if (batch == NULL) {
+        return NULL;
+    }
+    batch->num_slices = num_threads;
+    batch->slices = calloc(num_threads, sizeof(batch_slice));
+    bool created = (batch->slices != NULL);
+    for (int i = 0; created && i < num_threads; i++) {
+        batch->slices[i].context = nflate_context_create();
+        created = (batch->slices[i].context != NULL);
+    }
+    // the calling thread takes the first slice itself
+    if (created && num_threads > 1) {
+        batch->pool = threadpool_create(num_threads - 1);
+        created = (batch->pool != NULL);
+    }
+    if (!created) {
+        gzip_batch_free(batch);
+        return NULL;
+    }
+    return batch;
+}
+
+// inflate one item into the room set aside for it in item->output, which is
+// item->output_length bytes
+static void inflate_item(nflate_context *context, gzip_batch_item *item) {
+    size_t header_length = gzip_header_length(item->input, item->input_length);
+    if (header_length == 0) {
+        item->status = NFLATE_DATA_ERROR;
+        return;
+    }
+    size_t consumed;
+    uint32_t crc;
+    nflate_status status = nflate_context_into(context, item->input + header_length, item->input_length - header_length,
+                                               item->output, item->output_length, &item->output_length, &consumed, &crc);
+    size_t trailer = header_length + consumed;
+    if (status != NFLATE_DONE || item->input_length - trailer < TRAILER_LENGTH ||
+        gzip_read_le32(item->input + trailer) != crc ||
+        gzip_read_le32(item->input + trailer + 4) != (uint32_t)item->output_length) {
+        // running out of room means the trailer was wrong about the size
+        item->status = (status == NFLATE_MEMORY_ERROR) ? NFLATE_MEMORY_ERROR : NFLATE_DATA_ERROR;
+        return;
+    }
+    item->status = NFLATE_DONE;
+}
+
+static void inflate_slice(void *argument) {
+    batch_slice *slice = argument;
+    for (size_t i = 0; i < slice->count; i++) {
+        if (slice->items[i].status == NFLATE_OK) {
+            inflate_item(slice->context, &slice->items[i]);
+        }
+    }
+}
+
+size_t gzip_batch_inflate(gzip_batch *batch, gzip_batch_item *items, size_t count, uint8_t *memory, size_t capacity) {
+    // set aside room for each item in order; NFLATE_OK marks the ones still to inflate
+    size_t used = 0;
+    for (size_t i = 0; i < count; i++) {
+        gzip_batch_item *item = &items[i];
+        item->output = NULL;
+        item->output_length = 0;
+        if (item->input_length < TRAILER_LENGTH) {
+            item->status = NFLATE_DATA_ERROR;
+            continue;
+        }
+        size_t ISIZE = gzip_read_le32(item->input + item->input_length - 4); // name comes from RFC 1952
+        if (ISIZE > capacity - used) {
+            item->status = NFLATE_NEEDS_OUTPUT;
+            continue;
+        }
+        item->output = memory + used;
+        item->output_length = ISIZE;
+        item->status = NFLATE_OK;
+        used += ISIZE;
+    }
+
+    // split the items evenly between the threads
+    size_t per_slice = count / batch->num_slices;
+    size_t left_over = count % batch->num_slices;
+    threadpool_task **tasks = NULL;
+    if (batch->pool != NULL) {
+        tasks = calloc(batch->num_slices, sizeof(threadpool_task *));
+    }
+    size_t start = 0;
+    for (int i = 0; i < batch->num_slices; i++) {
+        batch_slice *slice = &batch->slices[i];
+        slice->items = items + start;
+        slice->count = per_slice + (((size_t)i < left_over) ? 1 : 0);
+        start += slice->count;
+        // without room for the tasks everything is done here
+        if (i > 0 && tasks != NULL) {
+            tasks[i] = threadpool_submit(batch->pool, inflate_slice, slice);
+            if (tasks[i] == NULL) {
+                inflate_slice(slice);
+            }
+        }
+    }
+    inflate_slice(&batch->slices[0]);
+    for (int i = 1; i < batch->num_slices; i++) {
+        if (tasks == NULL) {
+            inflate_slice(&batch->slices[i]);
+        } else if (tasks[i] != NULL) {
+            threadpool_join(batch->pool, tasks[i]);
+        }
+    }
+    free(tasks);
+
+    size_t inflated = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (items[i].status == NFLATE_DONE) {
+            inflated++;
+        }
+    }
+    return inflated;
+}
+
+void gzip_batch_free(gzip_batch *batch) {
+    if (batch == NULL) {
+        return;
+    }
+    threadpool_free(batch->pool);
+    if (batch->slices != NULL) {
+        for (int i = 0; i < batch->num_slices; i++) {
+            nflate_context_free(batch->slices[i].context);
+        }
+        free(batch->slices);
+    }
+    free(batch);
+}
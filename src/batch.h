@@ -0,0 +1,68 @@
+//
+//  batch.h
+//  nflate
+//
+//  Copyright (c) 2020 David Kopec
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+// Inflating lots of small gzip buffers, such as messages, in one call
+// Setting up for each buffer would cost more than inflating it, so a batch
+// keeps a decoding context per thread and its worker threads from one call
+// to the next, and everything is inflated into one block of memory the
+// caller provides.
+//
+//  gzip_batch *batch = gzip_batch_create(num_threads);
+//  for each group of buffers:
+//      fill in input and input_length of an item for each one
+//      gzip_batch_inflate(batch, items, count, memory, capacity);
+//      use the output of the items whose status is NFLATE_DONE
+//  gzip_batch_free(batch);
+
+#ifndef batch_h
+#define batch_h
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "nflate.h"
+
+typedef struct {
+    uint8_t *input; // a single gzip member: header, DEFLATE data and trailer
+    size_t input_length;
+
+    // filled in by gzip_batch_inflate()
+    uint8_t *output; // where the output is within the caller's memory, NULL if there was no room
+    size_t output_length;
+    nflate_status status; // NFLATE_DONE, NFLATE_NEEDS_OUTPUT if there wasn't room, or an error
+} gzip_batch_item;
+
+typedef struct gzip_batch gzip_batch;
+
+// set up a batch that inflates on *num_threads* threads, counting the one
+// calling gzip_batch_inflate()
+// returns NULL if out of memory
+gzip_batch *gzip_batch_create(int num_threads);
+
+// inflate every item into *memory*, which has room for *capacity* bytes
+// each item's room is set aside in order from the uncompressed size in its
+// trailer, so items that don't fit are skipped, and a trailer that is wrong
+// about the size makes its item an error
+// nothing is printed; the status of each item says how it went
+// returns how many items were inflated and matched their trailers
+size_t gzip_batch_inflate(gzip_batch *batch, gzip_batch_item *items, size_t count, uint8_t *memory, size_t capacity);
+
+// stop the worker threads and free the batch
+void gzip_batch_free(gzip_batch *batch);
+
+#endif /* batch_h */
@@ -0,0 +1,652 @@
+//
+//  bench.c
+//  nflate
+//
+//  Copyright (c) 2020 David Kopec
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+// Throughput benchmark, built with make bench
+// Times inflating, checksumming and parsing the headers of each input, after
+// some warmup runs, and reports the best and median of several runs in MB/s
+// and in cycles per byte, as a table, JSON or CSV.
+//  nflate_bench [-w warmups] [-n repetitions] [-f text|json|csv] [file.gz ...]
+// With no files, the samples are used. Generated inputs with stored and fixed
+// Huffman blocks are always added, since encoders rarely write those.
+// Built with NFLATE_BENCH_ZLIB (make bench ZLIB=1), zlib's inflate is timed
+// on the same inputs for comparison.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_RDTSC
+#elif defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#define HAVE_RDTSC
+#endif
+#ifdef NFLATE_BENCH_ZLIB
+#include <zlib.h>
+#endif
+#include "gzipfile.h"
+#include "nflate.h"
+#include "crc32.h"
+#include "adler32.h"
+#include "thread.h"
+#include "batch.h"
+#include "deflate.h"
+
+#define DEFAULT_WARMUPS 2
+#define DEFAULT_REPETITIONS 10
+#define HEADER_REPEATS 100000 // a header takes so little time that one parse can't be timed
+#define GENERATED_LENGTH (8 * 1024 * 1024)
+#define GENERATED_BLOCK_LENGTH 65535 // the most a stored block can hold
+#define MB 1000000.0
+#define TRAILER_LENGTH 8
+
+static const char *default_files[] = {"samples/pandp.txt.gz", "samples/house.jpg.gz", "samples/classes.xls.gz"};
+
+typedef struct {
+    char *name;
+    uint8_t *gz; // the whole gzip file
+    size_t gz_length;
+    size_t header_length;
+    size_t member_length; // the first member, from its header through its trailer
+    uint8_t *expected; // what the first member inflates to
+    size_t expected_length;
+} bench_input;
+
+// one thing to time; returns how many bytes it went through
+typedef size_t (*bench_function)(const bench_input *input, uint8_t *output);
+
+typedef struct {
+    const char *name;
+    bench_function run;
+} bench_operation;
+
+typedef enum { FORMAT_TEXT, FORMAT_JSON, FORMAT_CSV } bench_format;
+
+// results are folded into this so the compiler can't skip the work
+static volatile uint32_t sink;
+
+// the time stamp counter, which on current x86 processors ticks at a fixed
+// rate close to the base clock rather than counting the cycles of the core;
+// 0 where there isn't one
+static uint64_t cycles(void) {
+#ifdef HAVE_RDTSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static size_t run_inflate(const bench_input *input, uint8_t *output) {
+    size_t length = 0;
+    nflate_into(input->gz + input->header_length, input->gz_length - input->header_length, output, input->expected_length,
+                &length, NULL, NULL);
+    sink ^= output[0];
+    return input->expected_length;
+}
+
+static size_t run_inflate_crc(const bench_input *input, uint8_t *output) {
+    size_t length = 0;
+    uint32_t crc = 0;
+    nflate_into(input->gz + input->header_length, input->gz_length - input->header_length, output, input->expected_length,
+                &length, NULL, &crc);
+    sink ^= crc;
+    return input->expected_length;
+}
+
+static size_t run_crc32(const bench_input *input, uint8_t *output) {
+    (void)output;
+    sink ^= crc32_final(crc32_update(crc32_init(), input->expected, input->expected_length));
+    return input->expected_length;
+}
+
+static size_t run_adler32(const bench_input *input, uint8_t *output) {
+    (void)output;
+    sink ^= adler32_update(adler32_init(), input->expected, input->expected_length);
+    return input->expected_length;
+}
+
+static size_t run_header(const bench_input *input, uint8_t *output) {
+    (void)output;
+    size_t total = 0;
+    for (int i = 0; i < HEADER_REPEATS; i++) {
+        total += gzip_header_length(input->gz, input->gz_length);
+    }
+    sink ^= (uint32_t)total;
+    return total;
+}
+
+// compressing the inflated data again, counted in uncompressed bytes
+static size_t run_deflate(const bench_input *input, uint8_t *output, int level) {
+    deflater *d = deflater_create(level);
+    if (d == NULL) {
+        return 0;
+    }
+    sink ^= (uint32_t)deflater_compress(d, input->expected, 0, input->expected_length, true, output);
+    deflater_free(d);
+    return input->expected_length;
+}
+
+static size_t run_deflate_1(const bench_input *input, uint8_t *output) {
+    return run_deflate(input, output, 1);
+}
+
+static size_t run_deflate_6(const bench_input *input, uint8_t *output) {
+    return run_deflate(input, output, 6);
+}
+
+static size_t run_deflate_9(const bench_input *input, uint8_t *output) {
+    return run_deflate(input, output, 9);
+}
+
+#ifdef NFLATE_BENCH_ZLIB
+// zlib always checks the CRC-32, so this compares with inflate+crc32
+static size_t run_zlib(const bench_input *input, uint8_t *output) {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    inflateInit2(&stream, 16 + MAX_WBITS); // gzip wrapper
+    stream.next_in = input->gz;
+    stream.avail_in = (uInt)input->gz_length;
+    stream.next_out = output;
+    stream.avail_out = (uInt)input->expected_length;
+    inflate(&stream, Z_FINISH);
+    inflateEnd(&stream);
+    sink ^= output[0];
+    return input->expected_length;
+}
+#endif
+
+static const bench_operation operations[] = {
+    {"inflate", run_inflate},
+    {"inflate+crc32", run_inflate_crc},
+    {"crc32", run_crc32},
+    {"adler32", run_adler32},
+    {"header", run_header},
+    {"deflate -1", run_deflate_1},
+    {"deflate -6", run_deflate_6},
+    {"deflate -9", run_deflate_9},
+#ifdef NFLATE_BENCH_ZLIB
+    {"zlib+crc32", run_zlib},
+#endif
+};
+
+// Generated inputs
+
+// writes bits to a growing buffer starting with the least significant bit of
+// each byte, as DEFLATE packs them (RFC 1951 section 3.1.1)
+typedef struct {
+    uint8_t *data;
+    size_t length;
+    size_t capacity;
+    uint64_t buffer;
+    int count;
+} bit_writer;
+
+static bool put_byte(bit_writer *w, uint8_t byte) {
+    if (w->length == w->capacity) {
+        size_t capacity = (w->capacity > 0) ? w->capacity * 2 : 4096;
+        uint8_t *grown = realloc(w->data, capacity);
+        if (grown == NULL) {
+            return false;
+        }
+        w->data = grown;
+        w->capacity = capacity;
+    }
+    w->data[w->length++] = byte;
+    return true;
+}
+
+static bool put_bits(bit_writer *w, uint32_t value, int count) {
+    w->buffer |= (uint64_t)value << w->count;
+    w->count += count;
+    while (w->count >= 8) {
+        if (!put_byte(w, (uint8_t)w->buffer)) {
+            return false;
+        }
+        w->buffer >>= 8;
+        w->count -= 8;
+    }
+    return true;
+}
+
+// Huffman codes go most significant bit first
+static bool put_code(bit_writer *w, uint32_t code, int length) {
+    uint32_t reversed = 0;
+    for (int i = 0; i < length; i++) {
+        reversed = (reversed << 1) | ((code >> i) & 1);
+    }
+    return put_bits(w, reversed, length);
+}
+
+static bool align_to_byte(bit_writer *w) {
+    return (w->count == 0) || put_bits(w, 0, 8 - w->count);
+}
+
+static bool put_le32(bit_writer *w, uint32_t value) {
+    return put_bits(w, value & 0xFFFF, 16) && put_bits(w, value >> 16, 16);
+}
+
+// the fixed code of a literal/length symbol (RFC 1951 section 3.2.6)
+static bool put_fixed_symbol(bit_writer *w, int symbol) {
+    if (symbol < 144) {
+        return put_code(w, 0x30 + symbol, 8);
+    } else if (symbol < 256) {
+        return put_code(w, 0x190 + (symbol - 144), 9);
+    } else if (symbol < 280) {
+        return put_code(w, symbol - 256, 7);
+    }
+    return put_code(w, 0xC0 + (symbol - 280), 8);
+}
+
+// a match of *length* bytes, 3 to 258, one byte back
+static bool put_fixed_run(bit_writer *w, int length) {
+    static const uint16_t length_base[] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                           35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+    static const uint8_t length_extra[] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                           3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+    int code = 28;
+    while (length_base[code] > length) {
+        code--;
+    }
+    return put_fixed_symbol(w, 257 + code) && put_bits(w, (uint32_t)(length - length_base[code]), length_extra[code]) &&
+           put_code(w, 0, 5); // distance code 0 is a distance of 1
+}
+
+static bool put_stored_blocks(bit_writer *w, const uint8_t *data, size_t length) {
+    size_t position = 0;
+    do {
+        size_t block_length = length - position;
+        if (block_length > GENERATED_BLOCK_LENGTH) {
+            block_length = GENERATED_BLOCK_LENGTH;
+        }
+        bool final = (position + block_length == length);
+        if (!put_bits(w, final, 1) || !put_bits(w, 0, 2) || !align_to_byte(w) ||
+            !put_bits(w, (uint32_t)block_length, 16) || !put_bits(w, (uint32_t)~block_length & 0xFFFF, 16)) {
+            return false;
+        }
+        for (size_t i = 0; i < block_length; i++) {
+            if (!put_byte(w, data[position + i])) {
+                return false;
+            }
+        }
+        position += block_length;
+    } while (position < length);
+    return true;
+}
+
+// literals, with runs of a repeated byte as matches one byte back
+static bool put_fixed_blocks(bit_writer *w, const uint8_t *data, size_t length) {
+    size_t position = 0;
+    do {
+        size_t end = position + GENERATED_BLOCK_LENGTH;
+        if (end > length) {
+            end = length;
+        }
+        if (!put_bits(w, end == length, 1) || !put_bits(w, 1, 2)) {
+            return false;
+        }
+        while (position < end) {
+            if (!put_fixed_symbol(w, data[position])) {
+                return false;
+            }
+            size_t run = 0;
+            while (position + 1 + run < end && run < 258 && data[position + 1 + run] == data[position]) {
+                run++;
+            }
+            if (run >= 3) {
+                if (!put_fixed_run(w, (int)run)) {
+                    return false;
+                }
+                position += run;
+            }
+            position++;
+        }
+        if (!put_fixed_symbol(w, 256)) {
+            return false;
+        }
+    } while (position < length);
+    return align_to_byte(w);
+}
+
+// text made of words from a small vocabulary, padded into columns
+static void generate_text(uint8_t *data, size_t length) {
+    static const char *words[] = {"the", "of", "and", "inflate", "block", "Huffman", "window", "distance",
+                                  "length", "literal", "gzip", "member", "stream", "code", "table", "symbol"};
+    uint32_t random = 12345;
+    size_t position = 0;
+    while (position < length) {
+        random = random * 1103515245 + 12345;
+        const char *word = words[(random >> 16) % 16];
+        for (size_t i = 0; word[i] != '\0' && position < length; i++) {
+            data[position++] = (uint8_t)word[i];
+        }
+        size_t spaces = ((random >> 24) % 8 == 0) ? 1 + (random >> 28) * 4 : 1;
+        for (size_t i = 0; i < spaces && position < length; i++) {
+            data[position++] = ((random >> 20) % 16 == 0) ? '\n' : ' ';
+        }
+    }
+}
+
+static void generate_random(uint8_t *data, size_t length) {
+    uint32_t random = 54321;
+    for (size_t i = 0; i < length; i++) {
+        random = random * 1103515245 + 12345;
+        data[i] = (uint8_t)(random >> 16);
+    }
+}
+
+// wrap GENERATED_LENGTH bytes from *generate* in a gzip member with stored
+// or fixed Huffman blocks
+static bool generate_input(bench_input *input, const char *name, void (*generate)(uint8_t *, size_t), bool fixed) {
+    static const uint8_t header[] = {0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 255};
+    size_t length = GENERATED_LENGTH;
+    uint8_t *data = malloc(length);
+    if (data == NULL) {
+        fprintf(stderr, "Error allocating memory for %s.\n", name);
+        return false;
+    }
+    generate(data, length);
+    bit_writer w = {0};
+    bool written = true;
+    for (size_t i = 0; written && i < sizeof(header); i++) {
+        written = put_byte(&w, header[i]);
+    }
+    written = written && (fixed ? put_fixed_blocks(&w, data, length) : put_stored_blocks(&w, data, length)) &&
+              put_le32(&w, crc32_final(crc32_update(crc32_init(), data, length))) && put_le32(&w, (uint32_t)length);
+    input->name = malloc(strlen(name) + 1);
+    if (!written || input->name == NULL) {
+        fprintf(stderr, "Error allocating memory for %s.\n", name);
+        free(w.data);
+        free(input->name);
+        free(data);
+        input->name = NULL;
+        return false;
+    }
+    strcpy(input->name, name);
+    input->gz = w.data;
+    input->gz_length = w.length;
+    input->header_length = sizeof(header);
+    input->member_length = w.length;
+    input->expected = data;
+    input->expected_length = length;
+    return true;
+}
+
+// read a gzip file and inflate its first member once, to know what to expect
+static bool load_input(bench_input *input, const char *name) {
+    gzipfile *gzf = read_gzipfile(name);
+    if (gzf == NULL) {
+        fprintf(stderr, "Couldn't read %s.\n", name);
+        return false;
+    }
+    input->gz_length = gzf->contents_length;
+    input->gz = malloc(gzf->contents_length);
+    input->name = malloc(strlen(name) + 1);
+    if (input->gz == NULL || input->name == NULL) {
+        fprintf(stderr, "Error allocating memory for %s.\n", name);
+        free_gzfipfile(gzf);
+        return false;
+    }
+    memcpy(input->gz, gzf->contents, gzf->contents_length);
+    strcpy(input->name, name);
+    free_gzfipfile(gzf);
+    input->header_length = gzip_header_length(input->gz, input->gz_length);
+    size_t consumed = 0;
+    input->expected = nflate_member(input->gz + input->header_length, input->gz_length - input->header_length, 0,
+                                    &input->expected_length, &consumed, NULL);
+    input->member_length = input->header_length + consumed + TRAILER_LENGTH;
+    if (input->expected == NULL || input->member_length > input->gz_length) {
+        fprintf(stderr, "Couldn't inflate %s.\n", name);
+        return false;
+    }
+    return true;
+}
+
+// inflate the first member of every input as one batch, once with room for all
+// of them and once with a byte too little, which leaves the last without room
+static bool check_batch(const bench_input *inputs, int num_inputs) {
+    gzip_batch_item *items = calloc(num_inputs, sizeof(gzip_batch_item));
+    gzip_batch *batch = gzip_batch_create(thread_cpu_count());
+    size_t capacity = 0;
+    for (int i = 0; i < num_inputs; i++) {
+        capacity += inputs[i].expected_length;
+    }
+    uint8_t *memory = malloc(capacity);
+    bool correct = (items != NULL && batch != NULL && memory != NULL);
+    for (int pass = 0; correct && pass < 2; pass++) {
+        for (int i = 0; i < num_inputs; i++) {
+            items[i].input = inputs[i].gz;
+            items[i].input_length = inputs[i].member_length;
+        }
+        bool all_fit = (pass == 0);
+        size_t inflated = gzip_batch_inflate(batch, items, num_inputs, memory, all_fit ? capacity : capacity - 1);
+        correct = (inflated == (size_t)(all_fit ? num_inputs : num_inputs - 1));
+        for (int i = 0; correct && i < num_inputs; i++) {
+            if (!all_fit && i == num_inputs - 1) {
+                correct = (items[i].status == NFLATE_NEEDS_OUTPUT && items[i].output == NULL);
+            } else {
+                correct = (items[i].status == NFLATE_DONE && items[i].output_length == inputs[i].expected_length &&
+                           memcmp(items[i].output, inputs[i].expected, inputs[i].expected_length) == 0);
+            }
+        }
+    }
+    free(memory);
+    gzip_batch_free(batch);
+    free(items);
+    return correct;
+}
+
+static void free_input(bench_input *input) {
+    free(input->name);
+    free(input->gz);
+    free(input->expected);
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// write *text* as a quoted JSON or CSV string
+static void print_quoted(const char *text, bench_format format) {
+    putchar('"');
+    for (; *text != '\0'; text++) {
+        if (*text == '"') {
+            fputs((format == FORMAT_JSON) ? "\\\"" : "\"\"", stdout);
+        } else if (*text == '\\' && format == FORMAT_JSON) {
+            fputs("\\\\", stdout);
+        } else {
+            putchar(*text);
+        }
+    }
+    putchar('"');
+}
+
+// time *operation* on *input* and print a line of results
+static void bench(const bench_input *input, const bench_operation *operation, uint8_t *output, int warmups, int repetitions,
+                  bench_format format, bool first) {
+    double *seconds = malloc(repetitions * sizeof(double));
+    double *ticks = malloc(repetitions * sizeof(double));
+    if (seconds == NULL || ticks == NULL) {
+        fprintf(stderr, "Error allocating memory for results.\n");
+        free(seconds);
+        free(ticks);
+        return;
+    }
+    size_t bytes = 0;
+    for (int i = 0; i < warmups; i++) {
+        operation->run(input, output);
+    }
+    for (int i = 0; i < repetitions; i++) {
+        double start = thread_seconds();
+        uint64_t start_cycles = cycles();
+        bytes = operation->run(input, output);
+        ticks[i] = (double)(cycles() - start_cycles);
+        seconds[i] = thread_seconds() - start;
+    }
+    qsort(seconds, repetitions, sizeof(double), compare_doubles);
+    qsort(ticks, repetitions, sizeof(double), compare_doubles);
+    double best = seconds[0];
+    double median = seconds[repetitions / 2];
+    double mb_per_second = (median > 0) ? bytes / MB / median : 0;
+    double cycles_per_byte = (bytes > 0) ? ticks[repetitions / 2] / bytes : 0;
+    bool have_cycles = (ticks[repetitions / 2] > 0);
+
+    switch (format) {
+        case FORMAT_TEXT:
+            printf("%-28s %-14s %12zu %10.6f %10.6f %10.1f", input->name, operation->name, bytes, best, median, mb_per_second);
+            if (have_cycles) {
+                printf(" %8.2f\n", cycles_per_byte);
+            } else {
+                printf(" %8s\n", "-");
+            }
+            break;
+        case FORMAT_JSON:
+            printf("%s\n  {\"input\": ", first ? "" : ",");
+            print_quoted(input->name, format);
+            printf(", \"operation\": \"%s\", \"bytes\": %zu, \"compressed_bytes\": %zu, \"repetitions\": %d, "
+                   "\"best_seconds\": %.9f, \"median_seconds\": %.9f, \"mb_per_second\": %.3f, \"cycles_per_byte\": ",
+                   operation->name, bytes, input->gz_length, repetitions, best, median, mb_per_second);
+            if (have_cycles) {
+                printf("%.4f}", cycles_per_byte);
+            } else {
+                printf("null}");
+            }
+            break;
+        case FORMAT_CSV:
+            print_quoted(input->name, format);
+            printf(",%s,%zu,%zu,%d,%.9f,%.9f,%.3f,", operation->name, bytes, input->gz_length, repetitions, best, median, mb_per_second);
+            if (have_cycles) {
+                printf("%.4f", cycles_per_byte);
+            }
+            printf("\n");
+            break;
+    }
+    free(seconds);
+    free(ticks);
+}
+
+int main(int argc, const char * argv[]) {
+    int warmups = DEFAULT_WARMUPS;
+    int repetitions = DEFAULT_REPETITIONS;
+    bench_format format = FORMAT_TEXT;
+    while (argc > 2 && argv[1][0] == '-') {
+        if (!strcmp(argv[1], "-w")) {
+            warmups = atoi(argv[2]);
+        } else if (!strcmp(argv[1], "-n")) {
+            repetitions = atoi(argv[2]);
+        } else if (!strcmp(argv[1], "-f") && !strcmp(argv[2], "json")) {
+            format = FORMAT_JSON;
+        } else if (!strcmp(argv[1], "-f") && !strcmp(argv[2], "csv")) {
+            format = FORMAT_CSV;
+        } else if (!strcmp(argv[1], "-f") && !strcmp(argv[2], "text")) {
+            format = FORMAT_TEXT;
+        } else {
+            break;
+        }
+        argc -= 2;
+        argv += 2;
+    }
+    if ((argc > 1 && argv[1][0] == '-') || repetitions < 1 || warmups < 0) {
+        printf("Usage: nflate_bench [-w warmups] [-n repetitions] [-f text|json|csv] [file.gz ...]\n");
+        return 1;
+    }
+
+    // the files given, or the samples, followed by the generated inputs
+    const char **files = (argc > 1) ? argv + 1 : default_files;
+    int num_files = (argc > 1) ? argc - 1 : (int)(sizeof(default_files) / sizeof(default_files[0]));
+    int num_inputs = num_files + 3;
+    bench_input *inputs = calloc(num_inputs, sizeof(bench_input));
+    if (inputs == NULL) {
+        fprintf(stderr, "Error allocating memory for inputs.\n");
+        return 1;
+    }
+    bool loaded = true;
+    for (int i = 0; loaded && i < num_files; i++) {
+        loaded = load_input(&inputs[i], files[i]);
+    }
+    loaded = loaded && generate_input(&inputs[num_files], "generated text, fixed", generate_text, true) &&
+             generate_input(&inputs[num_files + 1], "generated text, stored", generate_text, false) &&
+             generate_input(&inputs[num_files + 2], "generated random, stored", generate_random, false);
+    if (!loaded) {
+        for (int i = 0; i < num_inputs; i++) {
+            free_input(&inputs[i]);
+        }
+        free(inputs);
+        fprintf(stderr, "Couldn't set up the benchmark.\n");
+        return 1;
+    }
+
+    size_t output_size = 1;
+    for (int i = 0; i < num_inputs; i++) {
+        if (deflate_bound(inputs[i].expected_length) > output_size) {
+            output_size = deflate_bound(inputs[i].expected_length);
+        }
+    }
+    uint8_t *output = malloc(output_size);
+    if (output == NULL) {
+        fprintf(stderr, "Error allocating memory for output.\n");
+        for (int i = 0; i < num_inputs; i++) {
+            free_input(&inputs[i]);
+        }
+        free(inputs);
+        return 1;
+    }
+
+    switch (format) {
+        case FORMAT_TEXT:
+            printf("%-28s %-14s %12s %10s %10s %10s %8s\n", "input", "operation", "bytes", "best s", "median s", "MB/s", "cyc/B");
+            break;
+        case FORMAT_JSON:
+            printf("[");
+            break;
+        case FORMAT_CSV:
+            printf("input,operation,bytes,compressed_bytes,repetitions,best_seconds,median_seconds,mb_per_second,cycles_per_byte\n");
+            break;
+    }
+    bool correct = check_batch(inputs, num_inputs);
+    if (!correct) {
+        fprintf(stderr, "The inputs didn't inflate to what was expected as a batch.\n");
+    }
+    bool first = true;
+    for (int i = 0; i < num_inputs; i++) {
+        for (size_t j = 0; j < sizeof(operations) / sizeof(operations[0]); j++) {
+            bench(&inputs[i], &operations[j], output, warmups, repetitions, format, first);
+            first = false;
+        }
+        // make sure what was timed was right
+        size_t length = 0;
+        nflate_status status = nflate_into(inputs[i].gz + inputs[i].header_length, inputs[i].gz_length - inputs[i].header_length,
+                                           output, inputs[i].expected_length, &length, NULL, NULL);
+        if (status != NFLATE_DONE || length != inputs[i].expected_length || memcmp(output, inputs[i].expected, length) != 0) {
+            fprintf(stderr, "%s didn't inflate to what was expected.\n", inputs[i].name);
+            correct = false;
+        }
+    }
+    if (format == FORMAT_JSON) {
+        printf("\n]\n");
+    }
+
+    free(output);
+    for (int i = 0; i < num_inputs; i++) {
+        free_input(&inputs[i]);
+    }
+    free(inputs);
+    return correct ? 0 : 1;
+}
@@ -0,0 +1,239 @@
+//
+//  bgzf.c
+//  nflate
+//
+//  Copyright (c) 2020 David Kopec
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bgzf.h"
+#include "batch.h"
+#include "nflate.h"
+#include "crc32.h"
+
+#define FIXED_HEADER_LENGTH 10
+#define FEXTRA 4
+#define TRAILER_LENGTH 8
+#define BATCH_BLOCKS 1024 // blocks inflated at once, up to 64 MB of output
+
+size_t bgzf_block_length(const uint8_t *data, size_t length) {
+    if (length < FIXED_HEADER_LENGTH + 2 || data[0] != 31 || data[1] != 139 || data[2] != 8 || !(data[3] & FEXTRA)) {
+        return 0;
+    }
+    size_t XLEN = data[10] | (data[11] << 8); // names come from RFC 1952
+    const uint8_t *extra = data + FIXED_HEADER_LENGTH + 2;
+    if (length - FIXED_HEADER_LENGTH - 2 < XLEN) {
+        return 0;
+    }
+    // subfields are SI1, SI2, a two byte LEN and LEN bytes of data
+    for (size_t i = 0; XLEN - i >= 4;) {
+        size_t LEN = extra[i + 2] | (extra[i + 3] << 8);
+        if (XLEN - i - 4 < LEN) {
+            return 0;
+        }
+        if (extra[i] == 'B' && extra[i + 1] == 'C' && LEN == 2) {
+            size_t block_length = (size_t)(extra[i + 4] | (extra[i + 5] << 8)) + 1; // BSIZE is one less
+            if (block_length > length) {
+                return 0;
+            }
+            // FNAME, FCOMMENT and FHCRC can follow the extra field, and all
+            // of the header has to leave room for the trailer
+            size_t header_length = gzip_header_length(data, block_length);
+            bool fits = header_length > 0 && header_length + TRAILER_LENGTH <= block_length;
+            return fits ? block_length : 0;
+        }
+        i += 4 + LEN;
+    }
+    return 0;
+}
+
+bool bgzf_detect(const gzipfile *gzf) {
+    return bgzf_block_length(gzf->contents, gzf->contents_length) > 0;
+}
+
+bgzf_index *bgzf_index_blocks(const gzipfile *gzf) {
+    bgzf_index *index = calloc(1, sizeof(bgzf_index));
+    if (index == NULL) {
+        fprintf(stderr, "Error allocating memory for BGZF blocks.\n");
+        return NULL;
+    }
+    size_t capacity = 0;
+    size_t offset = 0;
+    while (offset < gzf->contents_length) {
+        if (index->num_blocks == capacity) {
+            capacity = (capacity > 0) ? capacity * 2 : 1024;
+            bgzf_block *grown = realloc(index->blocks, capacity * sizeof(bgzf_block));
+            if (grown == NULL) {
+                fprintf(stderr, "Error allocating memory for BGZF blocks.\n");
+                bgzf_index_free(index);
+                return NULL;
+            }
+            index->blocks = grown;
+        }
+        size_t block_length = bgzf_block_length(gzf->contents + offset, gzf->contents_length - offset);
+        if (block_length == 0) {
+            bgzf_index_free(index);
+            return NULL;
+        }
+        bgzf_block *block = &index->blocks[index->num_blocks++];
+        block->compressed_offset = offset;
+        block->uncompressed_offset = index->uncompressed_length;
+        block->compressed_length = (uint32_t)block_length;
+        block->uncompressed_length = gzip_read_le32(gzf->contents + offset + block_length - 4);
+        index->uncompressed_length += block->uncompressed_length;
+        offset += block_length;
+    }
+    return index;
+}
+
+void bgzf_index_free(bgzf_index *index) {
+    if (index == NULL) {
+        return;
+    }
+    free(index->blocks);
+    free(index);
+}
+
+bool bgzf_inflate(gzipfile *gzf, const bgzf_index *index, int num_threads, members_writer write, void *context) {
+    size_t batch_blocks = (index->num_blocks < BATCH_BLOCKS) ? index->num_blocks : BATCH_BLOCKS;
+    size_t capacity = (batch_blocks > 0) ? batch_blocks * BGZF_MAX_BLOCK_LENGTH : 1;
+    gzip_batch *batch = gzip_batch_create(num_threads);
+    gzip_batch_item *items = malloc((batch_blocks > 0 ? batch_blocks : 1) * sizeof(gzip_batch_item));
+    uint8_t *memory = malloc(capacity);
+    bool inflated = (batch != NULL && items != NULL && memory != NULL);
+    if (!inflated) {
+        fprintf(stderr, "Error allocating memory for output.\n");
+    }
+    // a batch of blocks at a time, each inflated straight into its place in memory
+    for (size_t first = 0; inflated && first < index->num_blocks; first += batch_blocks) {
+        size_t count = (index->num_blocks - first < batch_blocks) ? index->num_blocks - first : batch_blocks;
+        size_t output_length = 0;
+        for (size_t i = 0; i < count; i++) {
+            const bgzf_block *block = &index->blocks[first + i];
+            items[i].input = gzf->contents + block->compressed_offset;
+            items[i].input_length = block->compressed_length;
+            output_length += block->uncompressed_length;
+        }
+        size_t done = gzip_batch_inflate(batch, items, count, memory, capacity);
+        if (done != count) {
+            for (size_t i = 0; i < count; i++) {
+                if (items[i].status != NFLATE_DONE) {
+                    fprintf(stderr, "Couldn't inflate the BGZF block at offset %llu.\n",
+                            (unsigned long long)index->blocks[first + i].compressed_offset);
+                    break;
+                }
+            }
+            inflated = false;
+        } else {
+            inflated = write(memory, output_length, context);
+        }
+    }
+    free(memory);
+    free(items);
+    gzip_batch_free(batch);
+    return inflated;
+}
+
+// the block that starts at *compressed_offset*, or NULL if none does
+static const bgzf_block *find_block(const bgzf_index *index, uint64_t compressed_offset) {
+    size_t low = 0;
+    size_t high = index->num_blocks;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (index->blocks[middle].compressed_offset < compressed_offset) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    bool found = (low < index->num_blocks && index->blocks[low].compressed_offset == compressed_offset);
+    return found ? &index->blocks[low] : NULL;
+}
+
+bool bgzf_virtual_offset(const bgzf_index *index, uint64_t offset, uint64_t *virtual_offset) {
+    if (offset >= index->uncompressed_length) {
+        return false;
+    }
+    // the last block starting at or before the offset
+    size_t low = 0;
+    size_t high = index->num_blocks;
+    while (high - low > 1) {
+        size_t middle = low + (high - low) / 2;
+        if (index->blocks[middle].uncompressed_offset <= offset) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+    // skip past empty blocks to the one that holds the byte
+    while (index->blocks[low].uncompressed_offset + index->blocks[low].uncompressed_length <= offset) {
+        low++;
+    }
+    const bgzf_block *block = &index->blocks[low];
+    *virtual_offset = BGZF_VIRTUAL_OFFSET(block->compressed_offset, offset - block->uncompressed_offset);
+    return true;
+}
+
+// inflate *block* into *dest*, which has room for BGZF_MAX_BLOCK_LENGTH bytes
+static bool inflate_block(gzipfile *gzf, const bgzf_block *block, uint8_t *dest) {
+    uint8_t *data = gzf->contents + block->compressed_offset;
+    size_t header_length = gzip_header_length(data, block->compressed_length);
+    if (header_length == 0 || block->uncompressed_length > BGZF_MAX_BLOCK_LENGTH) {
+        return false;
+    }
+    size_t length;
+    uint32_t crc;
+    nflate_status status = nflate_into(data + header_length, block->compressed_length - header_length - TRAILER_LENGTH, dest,
+                                       BGZF_MAX_BLOCK_LENGTH, &length, NULL, &crc);
+    const uint8_t *trailer = data + block->compressed_length - TRAILER_LENGTH;
+    return status == NFLATE_DONE && length == block->uncompressed_length && crc == gzip_read_le32(trailer);
+}
+
+bool bgzf_read(gzipfile *gzf, const bgzf_index *index, uint64_t virtual_offset, uint8_t *dest, size_t length, size_t *copied) {
+    *copied = 0;
+    const bgzf_block *block = find_block(index, virtual_offset >> 16);
+    size_t skip = (size_t)(virtual_offset & 0xFFFF);
+    // pointing right at the end of a block is allowed, and the same as the start of the next
+    if (block == NULL || skip > block->uncompressed_length) {
+        fprintf(stderr, "Virtual offset %llu isn't in a BGZF block.\n", (unsigned long long)virtual_offset);
+        return false;
+    }
+    uint8_t *buffer = malloc(BGZF_MAX_BLOCK_LENGTH);
+    if (buffer == NULL) {
+        fprintf(stderr, "Error allocating memory for output.\n");
+        return false;
+    }
+    const bgzf_block *end = index->blocks + index->num_blocks;
+    bool read = true;
+    for (; block < end && *copied < length; block++, skip = 0) {
+        if (skip == block->uncompressed_length) {
+            continue;
+        }
+        if (!inflate_block(gzf, block, buffer)) {
+            fprintf(stderr, "Couldn't inflate the BGZF block at offset %llu.\n", (unsigned long long)block->compressed_offset);
+            read = false;
+            break;
+        }
+        size_t piece = block->uncompressed_length - skip;
+        if (piece > length - *copied) {
+            piece = length - *copied;
+        }
+        memcpy(dest + *copied, buffer + skip, piece);
+        *copied += piece;
+    }
+    free(buffer);
+    return read;
+}
@@ -0,0 +1,86 @@
+//
+//  bgzf.h
+//  nflate
+//
+//  Copyright (c) 2020 David Kopec
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+// BGZF, the blocked gzip format of SAMtools, BAM and tabix
+// https://samtools.github.io/hts-specs/SAMv1.pdf (section 4.1)
+// A BGZF file is a series of gzip members of at most 64 KB each, with the
+// length of every member in a BC subfield of its FEXTRA field. Blocks can be
+// found without inflating anything and are all independent, so they can be
+// inflated in parallel, and any byte can be reached by inflating just its
+// block. Positions are given as virtual offsets: the offset of a block in the
+// file shifted left 16 bits, plus an offset into the output of that block.
+
+#ifndef bgzf_h
+#define bgzf_h
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "gzipfile.h"
+#include "members.h"
+
+#define BGZF_MAX_BLOCK_LENGTH 65536 // of a block and of its output
+#define BGZF_VIRTUAL_OFFSET(block_offset, offset_in_block) (((uint64_t)(block_offset) << 16) | (uint64_t)(offset_in_block))
+
+typedef struct {
+    uint64_t compressed_offset; // where the block starts in the file
+    uint64_t uncompressed_offset; // output of all of the blocks before it
+    uint32_t compressed_length; // the whole block, BSIZE + 1
+    uint32_t uncompressed_length; // ISIZE from its trailer
+} bgzf_block;
+
+typedef struct {
+    uint64_t uncompressed_length;
+    size_t num_blocks;
+    bgzf_block *blocks; // in file order
+} bgzf_index;
+
+// length of the BGZF block whose header is at the start of *data*, which is
+// *length* bytes long, from the BSIZE in its BC subfield
+// returns 0 if *data* doesn't start with a BGZF block that fits in *length*
+size_t bgzf_block_length(const uint8_t *data, size_t length);
+
+// does *gzf* start with a BGZF block?
+bool bgzf_detect(const gzipfile *gzf);
+
+// find every block of *gzf* by hopping from one header to the next, reading
+// just the header and trailer of each
+// returns NULL if the file isn't made of BGZF blocks all the way to its end,
+// without printing anything
+bgzf_index *bgzf_index_blocks(const gzipfile *gzf);
+
+void bgzf_index_free(bgzf_index *index);
+
+// inflate every block of *gzf* on *num_threads* threads, handing the output to
+// *write* along with *context* in order
+// returns false if a block couldn't be inflated or *write* failed
+bool bgzf_inflate(gzipfile *gzf, const bgzf_index *index, int num_threads, members_writer write, void *context);
+
+// the virtual offset of the byte *offset* bytes into the uncompressed data
+// returns false if *offset* is past the end of it
+bool bgzf_virtual_offset(const bgzf_index *index, uint64_t offset, uint64_t *virtual_offset);
+
+// copy up to *length* bytes of output starting at *virtual_offset* into *dest*,
+// inflating only the blocks they come from
+// *copied* is a pointer to a place to hold how many bytes were copied, which is
+// less than *length* only if the data ends first
+// returns false if *virtual_offset* isn't the start of a block plus an offset
+// within its output, or a block couldn't be inflated
+bool bgzf_read(gzipfile *gzf, const bgzf_index *index, uint64_t virtual_offset, uint8_t *dest, size_t length, size_t *copied);
+
+#endif /* bgzf_h */
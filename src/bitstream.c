@@ -31,42 +31,64 @@ bitstream *create_bitstream(uint8_t *data, size_t length) {
     return bs;
 }
 
-// READ FROM LSB TO MSB along BYTE boundaries
-bool bs_read_bit(bitstream *bs) {
-    bool answer = ((bs->data[bs->bitIndex / 8]) >> (bs->bitIndex % 8)) & 1;
-    bs->bitIndex++;
-    return answer;
+void bs_refill_tail(bitstream *bs) {
+    while (bs->bitCount < BS_MIN_REFILL_BITS) {
+        uint64_t byte = 0;
+        if (bs->byteIndex < bs->byteLength) {
+            byte = bs->data[bs->byteIndex];
+        }
+        bs->bitBuffer |= byte << bs->bitCount;
+        bs->byteIndex++;
+        bs->bitCount += 8;
+    }
 }
 
-//read up to 64 bits at a time
-uint64_t bs_read_bits(bitstream *bs, int n) {
-    uint64_t bits = 0;
-    for (int i = 0; i < n; i++) {
-        bits = (bits << 1) | bs_read_bit(bs);
+// discard the bit buffer and continue reading *bit_position* bits into the data
+void bs_seek(bitstream *bs, uint64_t bit_position) {
+    bs->byteIndex = (size_t)(bit_position / 8);
+    bs->bitBuffer = 0;
+    bs->bitCount = 0;
+    if (bit_position % 8 != 0) {
+        bs_refill(bs);
+        bs_consume_bits(bs, (int)(bit_position % 8));
     }
-    return bits;
 }
 
-// reversed, so in same ordering as originally in within the byte
-uint64_t bs_read_bits_rev(bitstream *bs, int n) {
+//read up to 32 bits at a time
+uint64_t bs_read_bits(bitstream *bs, int n) {
     uint64_t bits = 0;
     for (int i = 0; i < n; i++) {
-        bits |= (bs_read_bit(bs) << i);
+        bits = (bits << 1) | bs_read_bit(bs);
     }
     return bits;
 }
 
 // read bytes directly into *dest*
 void bs_read_bytes(bitstream *bs, uint8_t *dest, size_t length) {
-    memcpy(dest, bs->data + (bs->bitIndex / 8), length);
-    bs->bitIndex += (length * 8);
+    // hand back the whole bytes still sitting in the bit buffer
+    size_t buffered = bs->bitCount / 8;
+    bs->byteIndex -= buffered;
+    bs->bitBuffer = 0;
+    bs->bitCount = 0;
+    
+    size_t available = 0;
+    if (bs->byteIndex < bs->byteLength) {
+        available = bs->byteLength - bs->byteIndex;
+    }
+    if (available > length) {
+        available = length;
+    }
+    if (available > 0) {
+        memcpy(dest, bs->data + bs->byteIndex, available);
+    }
+    if (available < length) {
+        memset(dest + available, 0, length - available);
+    }
+    bs->byteIndex += length;
 }
 
 // go to next byte boundary if not already on one
 void bs_move_to_boundary(bitstream *bs) {
-    // are we on a boundary?
-    if (bs->bitIndex % 8 != 0) {
-        // skip any bits until the next byte boundary
-        bs->bitIndex = bs->bitIndex + (8 - (bs->bitIndex % 8));
-    }
+    // skip any bits until the next byte boundary
+    bs_consume_bits(bs, bs->bitCount % 8);
 }
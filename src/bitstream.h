@@ -21,26 +21,109 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <stddef.h>
+#include <string.h>
 
-
+// Bits are pulled from *data* into a 64-bit buffer a word at a time and
+// handed out from its low end, so the next bit in the stream is always bit 0
+// of bitBuffer. Callers refill once and then peek/consume several fields.
 typedef struct {
     uint8_t *data;
     size_t byteLength;
-    uint64_t bitIndex;
+    size_t byteIndex; // next byte of data to load into bitBuffer
+    uint64_t bitBuffer;
+    int bitCount; // number of loaded bits not yet consumed
 } bitstream;
 
+// bs_refill guarantees at least this many bits are buffered
+#define BS_MIN_REFILL_BITS 56
+
 bitstream *create_bitstream(uint8_t *data, size_t length);
 
-// read from LSB to MSB along byte boundaries
-bool bs_read_bit(bitstream *bs);
+// slow path of bs_refill for the last few bytes of data
+// bytes past the end of the data read as 0 (see bs_overrun)
+void bs_refill_tail(bitstream *bs);
 
-//read up to 64 bits at a time
-uint64_t bs_read_bits(bitstream *bs, int n);
+static inline uint64_t bs_load_le64(const uint8_t *p) {
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    word = __builtin_bswap64(word);
+#endif
+    return word;
+}
+
+// top up the bit buffer to at least BS_MIN_REFILL_BITS bits
+// while 8 bytes remain this is a single unaligned load with no branches on bitCount:
+// whole bytes that fit are counted and the rest of the word is loaded again next time
+static inline void bs_refill(bitstream *bs) {
+    if (bs->byteIndex + 8 <= bs->byteLength) {
+        bs->bitBuffer |= bs_load_le64(bs->data + bs->byteIndex) << bs->bitCount;
+        bs->byteIndex += (63 - bs->bitCount) >> 3;
+        bs->bitCount |= BS_MIN_REFILL_BITS;
+    } else {
+        bs_refill_tail(bs);
+    }
+}
+
+// look at the next n (up to 32) bits in the same order as bs_read_bits_rev without consuming them
+// there must be at least n bits buffered (see bs_refill)
+static inline uint32_t bs_peek_bits_rev(bitstream *bs, int n) {
+    return (uint32_t)(bs->bitBuffer & ((1ULL << n) - 1));
+}
+
+// consume n bits that are already buffered
+static inline void bs_consume_bits(bitstream *bs, int n) {
+    bs->bitBuffer >>= n;
+    bs->bitCount -= n;
+}
+
+// peek and consume n (up to 32) bits that are already buffered
+static inline uint32_t bs_pop_bits_rev(bitstream *bs, int n) {
+    uint32_t bits = bs_peek_bits_rev(bs, n);
+    bs_consume_bits(bs, n);
+    return bits;
+}
 
 // reversed, so in same ordering as originally in within the byte
-uint64_t bs_read_bits_rev(bitstream *bs, int n);
+// read up to 32 bits at a time, refilling if needed
+static inline uint64_t bs_read_bits_rev(bitstream *bs, int n) {
+    if (bs->bitCount < n) {
+        bs_refill(bs);
+    }
+    return bs_pop_bits_rev(bs, n);
+}
+
+// read from LSB to MSB along byte boundaries
+static inline bool bs_read_bit(bitstream *bs) {
+    return bs_read_bits_rev(bs, 1);
+}
+
+// number of bits consumed since the start of the data
+static inline uint64_t bs_bit_position(const bitstream *bs) {
+    return ((uint64_t)bs->byteIndex * 8) - bs->bitCount;
+}
+
+// true if bits past the end of the data have been consumed
+static inline bool bs_overrun(const bitstream *bs) {
+    return bs_bit_position(bs) > ((uint64_t)bs->byteLength * 8);
+}
+
+// number of bits of data that have not been consumed yet
+static inline uint64_t bs_bits_left(const bitstream *bs) {
+    uint64_t end = (uint64_t)bs->byteLength * 8;
+    uint64_t position = bs_bit_position(bs);
+    return (position < end) ? (end - position) : 0;
+}
+
+// discard the bit buffer and continue reading *bit_position* bits into the data
+void bs_seek(bitstream *bs, uint64_t bit_position);
+
+//read up to 32 bits at a time
+uint64_t bs_read_bits(bitstream *bs, int n);
 
-// read bytes, incrementing bitIndex with as many as needed
+// read bytes, incrementing the position with as many as needed
+// must be on a byte boundary (see bs_move_to_boundary)
 void bs_read_bytes(bitstream *bs, uint8_t *dest, size_t length);
 
 // go to next byte boundary if not already on one
@@ -18,24 +18,139 @@
 
 #include <stddef.h>
 #include "crc32.h"
+#include "thread.h"
 
-// This code is adapted from both RFC 1952 and Wikipedia's page on CRC
-// https://tools.ietf.org/html/rfc1952#section-8.1.1.6.2
-// https://en.wikipedia.org/wiki/Cyclic_redundancy_check#CRC-32_algorithm
-// The table code is originally Copyright 1996 L. Peter Deutsch and released under
-// a permissive license:
-//   Copyright (c) 1996 L. Peter Deutsch
-//
-//   Permission is granted to copy and distribute this document for any
-//   purpose and without charge, including translations into other
-//   languages and incorporation into compilations, provided that the
-//   copyright notice and this notice are preserved, and that any
-//   substantive changes or deletions from the original are clearly
-//   marked.
-bool doCRC32Check(uint8_t *data, size_t length, uint32_t crc_check) {
-    uint32_t crc32 = 0xFFFFFFFF;
-    uint32_t lookup_table[256];
+// carry-less multiplication is available to x86 compilers that understand
+// per-function target attributes or, like MSVC, don't need them
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#if defined(__GNUC__) || defined(__clang__)
+#define CRC32_PCLMUL
+#define PCLMUL_TARGET __attribute__((target("pclmul,sse4.1")))
+#include <cpuid.h>
+#include <immintrin.h>
+#elif defined(_MSC_VER)
+#define CRC32_PCLMUL
+#define PCLMUL_TARGET
+#include <intrin.h>
+#endif
+#endif
+
+// lookup_tables[0] is the classic byte-at-a-time table; lookup_tables[k][n] is
+// the CRC of byte n followed by k zero bytes, which lets eight bytes be folded
+// in with eight independent lookups (slicing-by-8)
+static uint32_t lookup_tables[8][256];
+// x2n_table[n] is x^(2^n) modulo the polynomial, for crc32_combine_length()
+static uint32_t x2n_table[32];
+static bool use_pclmul = false;
+static thread_once_flag setup_once = THREAD_ONCE_INIT;
+
+#ifdef CRC32_PCLMUL
+static bool cpu_has_pclmul(void) {
+    unsigned int ecx = 0;
+#if defined(_MSC_VER) && !defined(__clang__)
+    int registers[4];
+    __cpuid(registers, 1);
+    ecx = (unsigned int)registers[2];
+#else
+    unsigned int eax, ebx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return false;
+    }
+#endif
+    bool pclmulqdq = ecx & (1u << 1);
+    bool sse41 = ecx & (1u << 19);
+    return pclmulqdq && sse41;
+}
+
+// Fold 16-byte blocks with carry-less multiplication and Barrett-reduce the
+// result, as described in Intel's "Fast CRC Computation for Generic Polynomials
+// Using PCLMULQDQ Instruction" (Gopal et al.); constants are for the
+// bit-reflected gzip polynomial. *length* must be a multiple of 16 and at least 64.
+PCLMUL_TARGET static uint32_t crc32_pclmul(uint32_t crc, const uint8_t *data, size_t length) {
+    const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+    const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+    const __m128i k5k0 = _mm_set_epi64x(0x0000000000, 0x0163cd6124);
+    const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+    const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+    
+    __m128i x1 = _mm_loadu_si128((const __m128i *)(data + 0x00));
+    __m128i x2 = _mm_loadu_si128((const __m128i *)(data + 0x10));
+    __m128i x3 = _mm_loadu_si128((const __m128i *)(data + 0x20));
+    __m128i x4 = _mm_loadu_si128((const __m128i *)(data + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+    data += 64;
+    length -= 64;
+    
+    // fold four blocks at a time
+    while (length >= 64) {
+        __m128i x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+        __m128i x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+        __m128i x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+        __m128i x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i *)(data + 0x00)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i *)(data + 0x10)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i *)(data + 0x20)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i *)(data + 0x30)));
+        data += 64;
+        length -= 64;
+    }
+    
+    // fold the four blocks into one
+    __m128i x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+    
+    // fold any remaining single blocks
+    while (length >= 16) {
+        x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128((const __m128i *)data)), x5);
+        data += 16;
+        length -= 16;
+    }
+    
+    // fold 128 bits down to 64
+    x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, mask32);
+    x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
     
+    // Barrett reduction down to 32 bits
+    x2 = _mm_and_si128(x1, mask32);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+    x2 = _mm_and_si128(x2, mask32);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+    return (uint32_t)_mm_extract_epi32(x1, 1);
+}
+#endif
+
+// multiply *a* by *b* modulo the polynomial, both bit-reflected like the CRC
+// itself, so x^0 is the top bit
+static uint32_t multiply_mod_poly(uint32_t a, uint32_t b) {
+    uint32_t product = 0;
+    for (uint32_t m = 1u << 31; m != 0; m >>= 1) {
+        if (a & m) {
+            product ^= b;
+        }
+        b = (b & 1) ? (b >> 1) ^ 0xedb88320 : b >> 1;
+    }
+    return product;
+}
+
+static void setup(void) {
     // code from RFC 1952 for table
     // https://tools.ietf.org/html/rfc1952#section-8.1.1.6.2
     uint32_t c;
@@ -49,14 +164,96 @@ bool doCRC32Check(uint8_t *data, size_t length, uint32_t crc_check) {
                 c = c >> 1;
             }
         }
-        lookup_table[n] = c;
+        lookup_tables[0][n] = c;
+    }
+    for (n = 0; n < 256; n++) {
+        for (k = 1; k < 8; k++) {
+            c = lookup_tables[k - 1][n];
+            lookup_tables[k][n] = (c >> 8) ^ lookup_tables[0][c & 0xFF];
+        }
+    }
+    uint32_t power = 1u << 30; // x^1
+    for (n = 0; n < 32; n++) {
+        x2n_table[n] = power;
+        power = multiply_mod_poly(power, power);
+    }
+#ifdef CRC32_PCLMUL
+    use_pclmul = cpu_has_pclmul();
+#endif
+}
+
+static inline uint32_t load_le32(const uint8_t *p) {
+    return ((uint32_t)p[0]) | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+uint32_t crc32_init(void) {
+    return 0xFFFFFFFF;
+}
+
+// This code is adapted from both RFC 1952 and Wikipedia's page on CRC
+// https://tools.ietf.org/html/rfc1952#section-8.1.1.6.2
+// https://en.wikipedia.org/wiki/Cyclic_redundancy_check#CRC-32_algorithm
+// The table code is originally Copyright 1996 L. Peter Deutsch and released under
+// a permissive license:
+//   Copyright (c) 1996 L. Peter Deutsch
+//
+//   Permission is granted to copy and distribute this document for any
+//   purpose and without charge, including translations into other
+//   languages and incorporation into compilations, provided that the
+//   copyright notice and this notice are preserved, and that any
+//   substantive changes or deletions from the original are clearly
+//   marked.
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t length) {
+    thread_once(&setup_once, setup);
+    
+#ifdef CRC32_PCLMUL
+    if (use_pclmul && length >= 64) {
+        size_t blocks = length & ~(size_t)15;
+        crc = crc32_pclmul(crc, data, blocks);
+        data += blocks;
+        length -= blocks;
+    }
+#endif
+    
+    // slicing-by-8
+    while (length >= 8) {
+        uint32_t one = load_le32(data) ^ crc;
+        uint32_t two = load_le32(data + 4);
+        crc = lookup_tables[7][one & 0xFF] ^ lookup_tables[6][(one >> 8) & 0xFF] ^
+              lookup_tables[5][(one >> 16) & 0xFF] ^ lookup_tables[4][one >> 24] ^
+              lookup_tables[3][two & 0xFF] ^ lookup_tables[2][(two >> 8) & 0xFF] ^
+              lookup_tables[1][(two >> 16) & 0xFF] ^ lookup_tables[0][two >> 24];
+        data += 8;
+        length -= 8;
     }
     
     // based on Wikipedia pseudocode
     for (size_t i = 0; i < length; i++) {
-        int lookup_index = (crc32 ^ data[i]) & 0xFF;
-        crc32 = (crc32 >> 8) ^ lookup_table[lookup_index];
+        int lookup_index = (crc ^ data[i]) & 0xFF;
+        crc = (crc >> 8) ^ lookup_tables[0][lookup_index];
     }
-    crc32 ^= 0xFFFFFFFF;
+    return crc;
+}
+
+uint32_t crc32_final(uint32_t crc) {
+    return crc ^ 0xFFFFFFFF;
+}
+
+// appending *length2* bytes multiplies the CRC of the first piece by
+// x^(8 * length2), which is built up from the powers x^(2^n) for each bit of
+// the number of bits; the pre- and post-conditioning cancel out (as in zlib)
+uint32_t crc32_combine_length(uint32_t crc1, uint32_t crc2, uint64_t length2) {
+    thread_once(&setup_once, setup);
+    uint32_t shift = 1u << 31; // x^0
+    for (int n = 3; length2 != 0; length2 >>= 1, n++) {
+        if (length2 & 1) {
+            shift = multiply_mod_poly(x2n_table[n & 31], shift);
+        }
+    }
+    return multiply_mod_poly(shift, crc1) ^ crc2;
+}
+
+bool doCRC32Check(uint8_t *data, size_t length, uint32_t crc_check) {
+    uint32_t crc32 = crc32_final(crc32_update(crc32_init(), data, length));
     return crc32 == crc_check;
 }
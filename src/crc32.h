@@ -21,6 +21,22 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <stddef.h>
+
+// Incremental CRC-32 as used by gzip (RFC 1952 section 8)
+//  uint32_t crc = crc32_init();
+//  crc = crc32_update(crc, data, length); // as many times as needed
+//  uint32_t result = crc32_final(crc);
+// Large updates use carry-less multiplication on x86 processors that support
+// it and slicing-by-8 tables everywhere else.
+uint32_t crc32_init(void);
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t length);
+uint32_t crc32_final(uint32_t crc);
+
+// the CRC-32 of two pieces of data one after the other, from the final CRC-32
+// *crc1* of the first, and *crc2* and *length2* of the second, so pieces can be
+// checksummed on different threads
+uint32_t crc32_combine_length(uint32_t crc1, uint32_t crc2, uint64_t length2);
 
 bool doCRC32Check(uint8_t *data, size_t length, uint32_t crc_check);
 
@@ -0,0 +1,771 @@
+//
+//  deflate.c
+//  nflate
+//
+//  Copyright (c) 2020 David Kopec
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "deflate.h"
+#include "huffman.h"
+#include "crc32.h"
+#include "gzipfile.h"
+#include "thread.h"
+#include "threadpool.h"
+
+// Based on RFC 1951
+// https://tools.ietf.org/html/rfc1951
+
+#define NUM_LIT_LEN_SYMBOLS 286 // 286 and 287 are never used
+#define NUM_DIST_SYMBOLS 30
+#define NUM_CODE_LENGTH_SYMBOLS 19
+#define MAX_CODE_LENGTH_BITS 7
+#define END_OF_BLOCK 256
+#define NUM_LENGTH_CODES 29
+
+#define WINDOW_SIZE 32768
+#define WINDOW_MASK (WINDOW_SIZE - 1)
+#define MIN_MATCH 4 // positions are hashed by their next four bytes, so shorter matches aren't looked for
+#define MAX_MATCH 258
+#define HASH_BITS 15
+#define SYMBOLS_PER_BLOCK 16384 // a new block, with codes fit to it, starts after this many symbols
+#define MAX_STORED_LENGTH 65535
+#define SEGMENT_LENGTH ((size_t)1 << 30) // positions are 32-bit, so huge inputs are compressed a piece at a time
+
+// How hard each level looks for matches, as in zlib's configuration_table.
+// Up to level 3 a match is taken as soon as it's found, and only the
+// positions in matches up to *lazy* bytes long are added to the hash chains.
+// From level 4 on, a match is held back in case the next position has a
+// longer one, unless it is at least *lazy* bytes long already. Chains are
+// followed for up to *chain* positions, or a quarter of that when the match
+// held back is at least *good* bytes long, and searching stops at a match of
+// *nice* bytes.
+typedef struct {
+    uint16_t good;
+    uint16_t lazy;
+    uint16_t nice;
+    uint16_t chain;
+} level_config;
+
+static const level_config configs[DEFLATE_MAX_LEVEL + 1] = {
+    {0, 0, 0, 0}, // only stored blocks
+    {4, 4, 16, 1}, // a plain hash table
+    {4, 8, 32, 4},
+    {4, 16, 64, 16},
+    {4, 4, 16, 16},
+    {8, 16, 32, 32},
+    {8, 16, 128, 128},
+    {8, 32, 128, 256},
+    {32, 128, 258, 1024},
+    {32, 258, 258, 4096},
+};
+
+struct deflater {
+    int level;
+    level_config config;
+    int32_t head[1 << HASH_BITS]; // latest position with each hash, or -1
+    int32_t prev[WINDOW_SIZE]; // the position before each one in the window with the same hash
+
+    // the block being put together: literals with a distance of 0, and matches
+    uint16_t lit_lens[SYMBOLS_PER_BLOCK];
+    uint16_t dists[SYMBOLS_PER_BLOCK];
+    size_t num_symbols;
+    uint32_t lit_len_frequencies[NUM_LIT_LEN_SYMBOLS];
+    uint32_t dist_frequencies[NUM_DIST_SYMBOLS];
+    const uint8_t *block_start; // the data the block covers, for storing it if that's smaller
+    size_t block_length;
+
+    // output, written a 32-bit word at a time
+    uint8_t *out;
+    uint64_t bits;
+    int bit_count;
+};
+
+// what each length and distance code stands for (RFC 1951 section 3.2.5)
+static const uint16_t length_base[NUM_LENGTH_CODES] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                                       35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t length_extra[NUM_LENGTH_CODES] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                                       3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t dist_base[NUM_DIST_SYMBOLS] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                                                     257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+                                                     8193, 12289, 16385, 24577};
+static const uint8_t dist_extra[NUM_DIST_SYMBOLS] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+                                                     7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+static const uint8_t code_length_order[NUM_CODE_LENGTH_SYMBOLS] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+// lookup tables from a length or distance to its code, and the fixed codes,
+// filled in once
+static uint8_t length_codes[MAX_MATCH + 1];
+static uint8_t near_dist_codes[256]; // by distance - 1
+static uint8_t far_dist_codes[256]; // by (distance - 1) >> 7, for distances over 256
+static uint8_t fixed_lit_len_lengths[NUM_LIT_LEN_SYMBOLS];
+static uint16_t fixed_lit_len_codes[NUM_LIT_LEN_SYMBOLS];
+static uint8_t fixed_dist_lengths[NUM_DIST_SYMBOLS];
+static uint16_t fixed_dist_codes[NUM_DIST_SYMBOLS];
+static thread_once_flag tables_once = THREAD_ONCE_INIT;
+
+// Huffman codes are packed starting with their most significant bit, but bits
+// are written starting with the least significant one
+static uint16_t reverse_code(uint16_t code, int length) {
+    uint16_t reversed = 0;
+    for (int i = 0; i < length; i++) {
+        reversed = (uint16_t)((reversed << 1) | (code & 1));
+        code >>= 1;
+    }
+    return reversed;
+}
+
+// canonical codes for *code_lengths*, ready to be written
+static void make_codes(const uint8_t *code_lengths, int num_symbols, uint16_t *codes) {
+    huffman_canonical_codes(code_lengths, num_symbols, codes);
+    for (int n = 0; n < num_symbols; n++) {
+        codes[n] = reverse_code(codes[n], code_lengths[n]);
+    }
+}
+
+static void build_tables(void) {
+    for (int code = 0; code < NUM_LENGTH_CODES; code++) {
+        int end = (code + 1 < NUM_LENGTH_CODES) ? length_base[code + 1] : MAX_MATCH + 1;
+        for (int length = length_base[code]; length < end; length++) {
+            length_codes[length] = (uint8_t)code;
+        }
+    }
+    // 258 has a code of its own, rather than being 227 plus 31
+    length_codes[MAX_MATCH] = NUM_LENGTH_CODES - 1;
+    for (int code = 0; code < NUM_DIST_SYMBOLS; code++) {
+        int end = dist_base[code] + (1 << dist_extra[code]);
+        for (int distance = dist_base[code]; distance < end; distance++) {
+            if (distance <= 256) {
+                near_dist_codes[distance - 1] = (uint8_t)code;
+            } else {
+                far_dist_codes[(distance - 1) >> 7] = (uint8_t)code;
+            }
+        }
+    }
+
+    // this is specified by RFC 1951 section 3.2.6
+    for (int n = 0; n < NUM_LIT_LEN_SYMBOLS; n++) {
+        fixed_lit_len_lengths[n] = (n < 144) ? 8 : (n < 256) ? 9 : (n < 280) ? 7 : 8;
+    }
+    make_codes(fixed_lit_len_lengths, NUM_LIT_LEN_SYMBOLS, fixed_lit_len_codes);
+    for (int n = 0; n < NUM_DIST_SYMBOLS; n++) {
+        fixed_dist_lengths[n] = 5;
+    }
+    make_codes(fixed_dist_lengths, NUM_DIST_SYMBOLS, fixed_dist_codes);
+}
+
+static inline int dist_code(int distance) {
+    return (distance <= 256) ? near_dist_codes[distance - 1] : far_dist_codes[(distance - 1) >> 7];
+}
+
+// Bit output
+
+// add *count* bits of *value*, up to 32 of them
+static inline void put_bits(deflater *d, uint32_t value, int count) {
+    d->bits |= (uint64_t)value << d->bit_count;
+    d->bit_count += count;
+    if (d->bit_count >= 32) {
+        d->out[0] = (uint8_t)d->bits;
+        d->out[1] = (uint8_t)(d->bits >> 8);
+        d->out[2] = (uint8_t)(d->bits >> 16);
+        d->out[3] = (uint8_t)(d->bits >> 24);
+        d->out += 4;
+        d->bits >>= 32;
+        d->bit_count -= 32;
+    }
+}
+
+// write out the bits left over, padding the last byte with zeros
+static void align_to_byte(deflater *d) {
+    while (d->bit_count > 0) {
+        *d->out++ = (uint8_t)d->bits;
+        d->bits >>= 8;
+        d->bit_count = (d->bit_count > 8) ? d->bit_count - 8 : 0;
+    }
+    d->bits = 0;
+}
+
+// Blocks
+
+// the code lengths of a dynamic block, run-length encoded as in RFC 1951 section 3.2.7
+typedef struct {
+    uint8_t lit_len_lengths[NUM_LIT_LEN_SYMBOLS];
+    uint8_t dist_lengths[NUM_DIST_SYMBOLS];
+    int HLIT; // name comes from RFC 1951
+    int HDIST; // name comes from RFC 1951
+    int HCLEN; // name comes from RFC 1951
+    uint8_t symbols[NUM_LIT_LEN_SYMBOLS + NUM_DIST_SYMBOLS];
+    uint8_t extra[NUM_LIT_LEN_SYMBOLS + NUM_DIST_SYMBOLS];
+    int num_symbols;
+    uint32_t frequencies[NUM_CODE_LENGTH_SYMBOLS];
+    uint8_t code_lengths[NUM_CODE_LENGTH_SYMBOLS];
+} dynamic_header;
+
+static void add_code_length_symbol(dynamic_header *h, int symbol, int extra) {
+    h->symbols[h->num_symbols] = (uint8_t)symbol;
+    h->extra[h->num_symbols] = (uint8_t)extra;
+    h->num_symbols++;
+    h->frequencies[symbol]++;
+}
+
+// the literal/length and distance code lengths form one sequence, so runs
+// may carry over from one into the other
+static void encode_code_lengths(dynamic_header *h) {
+    uint8_t lengths[NUM_LIT_LEN_SYMBOLS + NUM_DIST_SYMBOLS];
+    memcpy(lengths, h->lit_len_lengths, h->HLIT);
+    memcpy(lengths + h->HLIT, h->dist_lengths, h->HDIST);
+    int total = h->HLIT + h->HDIST;
+    h->num_symbols = 0;
+    memset(h->frequencies, 0, sizeof(h->frequencies));
+    for (int i = 0; i < total;) {
+        int length = lengths[i];
+        int run = 1;
+        while (i + run < total && lengths[i + run] == length) {
+            run++;
+        }
+        i += run;
+        if (length == 0) {
+            while (run >= 11) {
+                int repeat = (run < 138) ? run : 138;
+                add_code_length_symbol(h, 18, repeat - 11);
+                run -= repeat;
+            }
+            if (run >= 3) {
+                add_code_length_symbol(h, 17, run - 3);
+                run = 0;
+            }
+        } else {
+            // a repeat copies the length before it, so the length comes first
+            add_code_length_symbol(h, length, 0);
+            run--;
+            while (run >= 3) {
+                int repeat = (run < 6) ? run : 6;
+                add_code_length_symbol(h, 16, repeat - 3);
+                run -= repeat;
+            }
+        }
+        for (; run > 0; run--) {
+            add_code_length_symbol(h, length, 0);
+        }
+    }
+    huffman_code_lengths(h->frequencies, NUM_CODE_LENGTH_SYMBOLS, MAX_CODE_LENGTH_BITS, h->code_lengths);
+    h->HCLEN = NUM_CODE_LENGTH_SYMBOLS;
+    while (h->HCLEN > 4 && h->code_lengths[code_length_order[h->HCLEN - 1]] == 0) {
+        h->HCLEN--;
+    }
+}
+
+// bits taken by the symbols of the block with the given code lengths, not counting the block header
+static uint64_t symbol_bits(const deflater *d, const uint8_t *lit_len_lengths, const uint8_t *dist_lengths) {
+    uint64_t bits = 0;
+    for (int n = 0; n < NUM_LIT_LEN_SYMBOLS; n++) {
+        uint32_t extra = (n > END_OF_BLOCK) ? length_extra[n - END_OF_BLOCK - 1] : 0;
+        bits += (uint64_t)d->lit_len_frequencies[n] * (lit_len_lengths[n] + extra);
+    }
+    for (int n = 0; n < NUM_DIST_SYMBOLS; n++) {
+        bits += (uint64_t)d->dist_frequencies[n] * (dist_lengths[n] + dist_extra[n]);
+    }
+    return bits;
+}
+
+static uint64_t dynamic_header_bits(const dynamic_header *h) {
+    uint64_t bits = 5 + 5 + 4 + 3 * (uint64_t)h->HCLEN;
+    for (int i = 0; i < h->num_symbols; i++) {
+        int symbol = h->symbols[i];
+        bits += h->code_lengths[symbol] + ((symbol == 16) ? 2 : (symbol == 17) ? 3 : (symbol == 18) ? 7 : 0);
+    }
+    return bits;
+}
+
+static void write_dynamic_header(deflater *d, const dynamic_header *h) {
+    put_bits(d, (uint32_t)(h->HLIT - 257), 5);
+    put_bits(d, (uint32_t)(h->HDIST - 1), 5);
+    put_bits(d, (uint32_t)(h->HCLEN - 4), 4);
+    for (int i = 0; i < h->HCLEN; i++) {
+        put_bits(d, h->code_lengths[code_length_order[i]], 3);
+    }
+    uint16_t codes[NUM_CODE_LENGTH_SYMBOLS];
+    make_codes(h->code_lengths, NUM_CODE_LENGTH_SYMBOLS, codes);
+    for (int i = 0; i < h->num_symbols; i++) {
+        int symbol = h->symbols[i];
+        put_bits(d, codes[symbol], h->code_lengths[symbol]);
+        if (symbol >= 16) {
+            put_bits(d, h->extra[i], (symbol == 16) ? 2 : (symbol == 17) ? 3 : 7);
+        }
+    }
+}
+
+static void write_symbols(deflater *d, const uint16_t *lit_len_codes, const uint8_t *lit_len_lengths,
+                          const uint16_t *dist_codes, const uint8_t *dist_lengths) {
+    for (size_t i = 0; i < d->num_symbols; i++) {
+        int distance = d->dists[i];
+        if (distance == 0) {
+            int literal = d->lit_lens[i];
+            put_bits(d, lit_len_codes[literal], lit_len_lengths[literal]);
+            continue;
+        }
+        // the code and extra bits of a length fit in one go, and so do those of a distance
+        int length = d->lit_lens[i];
+        int code = length_codes[length];
+        int symbol = END_OF_BLOCK + 1 + code;
+        put_bits(d, lit_len_codes[symbol] | ((uint32_t)(length - length_base[code]) << lit_len_lengths[symbol]),
+                 lit_len_lengths[symbol] + length_extra[code]);
+        code = dist_code(distance);
+        put_bits(d, dist_codes[code] | ((uint32_t)(distance - dist_base[code]) << dist_lengths[code]),
+                 dist_lengths[code] + dist_extra[code]);
+    }
+    put_bits(d, lit_len_codes[END_OF_BLOCK], lit_len_lengths[END_OF_BLOCK]);
+}
+
+// this is specified by RFC 1951 section 3.2.4
+static void write_stored(deflater *d, const uint8_t *data, size_t length, bool final) {
+    do {
+        size_t piece = (length < MAX_STORED_LENGTH) ? length : MAX_STORED_LENGTH;
+        put_bits(d, final && piece == length, 1);
+        put_bits(d, 0, 2);
+        align_to_byte(d);
+        put_bits(d, (uint32_t)piece, 16);
+        put_bits(d, (uint32_t)piece ^ 0xFFFF, 16);
+        memcpy(d->out, data, piece);
+        d->out += piece;
+        data += piece;
+        length -= piece;
+    } while (length > 0);
+}
+
+// write the symbols gathered so far as a block, in whichever form is smallest
+static void flush_block(deflater *d, bool final) {
+    d->lit_len_frequencies[END_OF_BLOCK]++;
+
+    dynamic_header h;
+    huffman_code_lengths(d->lit_len_frequencies, NUM_LIT_LEN_SYMBOLS, HUFFMAN_MAX_BITS, h.lit_len_lengths);
+    huffman_code_lengths(d->dist_frequencies, NUM_DIST_SYMBOLS, HUFFMAN_MAX_BITS, h.dist_lengths);
+    h.HLIT = NUM_LIT_LEN_SYMBOLS;
+    while (h.HLIT > 257 && h.lit_len_lengths[h.HLIT - 1] == 0) {
+        h.HLIT--;
+    }
+    h.HDIST = NUM_DIST_SYMBOLS;
+    while (h.HDIST > 1 && h.dist_lengths[h.HDIST - 1] == 0) {
+        h.HDIST--;
+    }
+    encode_code_lengths(&h);
+
+    uint64_t dynamic_bits = 3 + dynamic_header_bits(&h) + symbol_bits(d, h.lit_len_lengths, h.dist_lengths);
+    uint64_t fixed_bits = 3 + symbol_bits(d, fixed_lit_len_lengths, fixed_dist_lengths);
+    // each piece of a stored block has a 3 bit header padded out to a byte, then LEN and NLEN
+    uint64_t pieces = (d->block_length > 0) ? (d->block_length + MAX_STORED_LENGTH - 1) / MAX_STORED_LENGTH : 1;
+    uint64_t first_padding = (8 - (d->bit_count + 3) % 8) % 8;
+    uint64_t stored_bits = (uint64_t)d->block_length * 8 + pieces * 32 + 3 + first_padding + (pieces - 1) * 8;
+
+    if (stored_bits < dynamic_bits && stored_bits < fixed_bits) {
+        write_stored(d, d->block_start, d->block_length, final);
+    } else if (fixed_bits <= dynamic_bits) {
+        put_bits(d, final, 1);
+        put_bits(d, 1, 2);
+        write_symbols(d, fixed_lit_len_codes, fixed_lit_len_lengths, fixed_dist_codes, fixed_dist_lengths);
+    } else {
+        put_bits(d, final, 1);
+        put_bits(d, 2, 2);
+        write_dynamic_header(d, &h);
+        uint16_t lit_len_codes[NUM_LIT_LEN_SYMBOLS];
+        uint16_t dist_codes[NUM_DIST_SYMBOLS];
+        make_codes(h.lit_len_lengths, NUM_LIT_LEN_SYMBOLS, lit_len_codes);
+        make_codes(h.dist_lengths, NUM_DIST_SYMBOLS, dist_codes);
+        write_symbols(d, lit_len_codes, h.lit_len_lengths, dist_codes, h.dist_lengths);
+    }
+
+    d->block_start += d->block_length;
+    d->block_length = 0;
+    d->num_symbols = 0;
+    memset(d->lit_len_frequencies, 0, sizeof(d->lit_len_frequencies));
+    memset(d->dist_frequencies, 0, sizeof(d->dist_frequencies));
+}
+
+static inline void add_literal(deflater *d, uint8_t literal) {
+    d->lit_lens[d->num_symbols] = literal;
+    d->dists[d->num_symbols] = 0;
+    d->num_symbols++;
+    d->lit_len_frequencies[literal]++;
+    d->block_length++;
+    if (d->num_symbols == SYMBOLS_PER_BLOCK) {
+        flush_block(d, false);
+    }
+}
+
+static inline void add_match(deflater *d, int length, int distance) {
+    d->lit_lens[d->num_symbols] = (uint16_t)length;
+    d->dists[d->num_symbols] = (uint16_t)distance;
+    d->num_symbols++;
+    d->lit_len_frequencies[END_OF_BLOCK + 1 + length_codes[length]]++;
+    d->dist_frequencies[dist_code(distance)]++;
+    d->block_length += length;
+    if (d->num_symbols == SYMBOLS_PER_BLOCK) {
+        flush_block(d, false);
+    }
+}
+
+// Matching
+
+static inline uint32_t load32(const uint8_t *p) {
+    uint32_t value;
+    memcpy(&value, p, 4);
+    return value;
+}
+
+static inline uint32_t hash(const uint8_t *p) {
+    return (load32(p) * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// make *position* the latest one with its hash
+// returns the one that was latest before, or -1
+static inline int32_t insert(deflater *d, const uint8_t *data, int32_t position) {
+    uint32_t h = hash(data + position);
+    int32_t previous = d->head[h];
+    d->head[h] = position;
+    d->prev[position & WINDOW_MASK] = previous;
+    return previous;
+}
+
+// how many bytes, up to *max*, *a* and *b* have in common at the start
+static inline size_t common_length(const uint8_t *a, const uint8_t *b, size_t max) {
+    size_t length = 0;
+    while (length + 8 <= max) {
+        uint64_t x, y;
+        memcpy(&x, a + length, 8);
+        memcpy(&y, b + length, 8);
+        if (x != y) {
+            break;
+        }
+        length += 8;
+    }
+    while (length < max && a[length] == b[length]) {
+        length++;
+    }
+    return length;
+}
+
+// follow the chain starting at *candidate* for the longest match at
+// *position* longer than *shorter_than*, up to *max_length* bytes
+// returns its length and stores its distance in *distance*, or returns 0 if there isn't one
+static inline size_t longest_match(const deflater *d, const uint8_t *data, int32_t position, int32_t candidate,
+                                   size_t max_length, size_t shorter_than, int chain, int *distance) {
+    const uint8_t *here = data + position;
+    size_t best = (shorter_than >= MIN_MATCH - 1) ? shorter_than : MIN_MATCH - 1;
+    size_t found = 0;
+    if (best >= max_length) {
+        return 0;
+    }
+    while (candidate >= 0 && position - candidate <= WINDOW_SIZE && chain-- > 0) {
+        const uint8_t *there = data + candidate;
+        // a longer match has to get the byte past the best so far right too
+        if (there[best] == here[best] && load32(there) == load32(here)) {
+            size_t length = common_length(here, there, max_length);
+            if (length > best) {
+                best = length;
+                found = length;
+                *distance = position - candidate;
+                if (length >= d->config.nice || length == max_length) {
+                    break;
+                }
+            }
+        }
+        int32_t next = d->prev[candidate & WINDOW_MASK];
+        if (next >= candidate) {
+            break; // the slot has been reused by a position too far back to matter
+        }
+        candidate = next;
+    }
+    return found;
+}
+
+// levels 1 to 3: take each match as it's found
+static void compress_greedy(deflater *d, const uint8_t *data, int32_t position, int32_t end) {
+    while (position < end) {
+        size_t length = 0;
+        int distance = 0;
+        if (end - position >= MIN_MATCH) {
+            int32_t candidate = insert(d, data, position);
+            size_t max_length = (end - position < MAX_MATCH) ? (size_t)(end - position) : MAX_MATCH;
+            length = longest_match(d, data, position, candidate, max_length, 0, d->config.chain, &distance);
+        }
+        if (length == 0) {
+            add_literal(d, data[position]);
+            position++;
+            continue;
+        }
+        add_match(d, (int)length, distance);
+        // long matches are skipped over without being added to the chains, which is much faster
+        int32_t match_end = position + (int32_t)length;
+        if (length <= d->config.lazy) {
+            for (position++; position < match_end && end - position >= MIN_MATCH; position++) {
+                insert(d, data, position);
+            }
+        }
+        position = match_end;
+    }
+}
+
+// levels 4 to 9: hold on to each match for a position in case the next one has a longer one
+static void compress_lazy(deflater *d, const uint8_t *data, int32_t position, int32_t end) {
+    bool pending = false; // the byte before *position* hasn't been written yet
+    size_t pending_length = 0; // the length of the match held back, or 0 if it's a literal
+    int pending_distance = 0;
+    while (position < end) {
+        size_t length = 0;
+        int distance = 0;
+        if (end - position >= MIN_MATCH) {
+            int32_t candidate = insert(d, data, position);
+            if (pending_length < d->config.lazy) {
+                size_t max_length = (end - position < MAX_MATCH) ? (size_t)(end - position) : MAX_MATCH;
+                int chain = (pending_length >= d->config.good) ? d->config.chain / 4 : d->config.chain;
+                length = longest_match(d, data, position, candidate, max_length, pending_length, chain, &distance);
+            }
+        }
+        if (pending && pending_length > 0 && length <= pending_length) {
+            // the match held back is as good as it gets; it started at the byte before
+            add_match(d, (int)pending_length, pending_distance);
+            int32_t match_end = position - 1 + (int32_t)pending_length;
+            for (position++; position < match_end && end - position >= MIN_MATCH; position++) {
+                insert(d, data, position);
+            }
+            position = match_end;
+            pending = false;
+            pending_length = 0;
+            continue;
+        }
+        if (pending) {
+            add_literal(d, data[position - 1]);
+        }
+        pending = true;
+        pending_length = length;
+        pending_distance = distance;
+        position++;
+    }
+    if (pending) {
+        add_literal(d, data[position - 1]);
+    }
+}
+
+deflater *deflater_create(int level) {
+    if (level < DEFLATE_MIN_LEVEL || level > DEFLATE_MAX_LEVEL) {
+        level = DEFLATE_DEFAULT_LEVEL;
+    }
+    thread_once(&tables_once, build_tables);
+    deflater *d = malloc(sizeof(deflater));
+    if (d == NULL) {
+        return NULL;
+    }
+    d->level = level;
+    d->config = configs[level];
+    return d;
+}
+
+size_t deflater_compress(deflater *d, const uint8_t *data, size_t dictionary_length, size_t length, bool final, uint8_t *dest) {
+    // only the last 32 KB of the dictionary can be referred to
+    if (dictionary_length > WINDOW_SIZE) {
+        data += dictionary_length - WINDOW_SIZE;
+        dictionary_length = WINDOW_SIZE;
+    }
+    d->out = dest;
+    d->bits = 0;
+    d->bit_count = 0;
+    d->num_symbols = 0;
+    memset(d->lit_len_frequencies, 0, sizeof(d->lit_len_frequencies));
+    memset(d->dist_frequencies, 0, sizeof(d->dist_frequencies));
+
+    const uint8_t *segment = data + dictionary_length;
+    size_t left = length;
+    do {
+        size_t piece = (left < SEGMENT_LENGTH) ? left : SEGMENT_LENGTH;
+        bool last = (piece == left);
+        d->block_start = segment;
+        d->block_length = 0;
+        if (d->level == 0) {
+            write_stored(d, segment, piece, final && last);
+        } else {
+            memset(d->head, 0xFF, sizeof(d->head));
+            const uint8_t *window = segment - dictionary_length;
+            for (int32_t position = 0; position + MIN_MATCH <= (int32_t)dictionary_length; position++) {
+                insert(d, window, position);
+            }
+            int32_t start = (int32_t)dictionary_length;
+            int32_t end = start + (int32_t)piece;
+            if (d->level >= 4) {
+                compress_lazy(d, window, start, end);
+            } else {
+                compress_greedy(d, window, start, end);
+            }
+            flush_block(d, final && last);
+        }
+        segment += piece;
+        left -= piece;
+        dictionary_length = WINDOW_SIZE; // the next piece follows on from this one
+    } while (left > 0);
+
+    if (!final) {
+        // an empty stored block to end on a byte boundary
+        put_bits(d, 0, 3);
+        align_to_byte(d);
+        put_bits(d, 0xFFFF0000, 32);
+    }
+    align_to_byte(d);
+    return (size_t)(d->out - dest);
+}
+
+void deflater_free(deflater *d) {
+    free(d);
+}
+
+size_t deflate_bound(size_t length) {
+    // blocks are only ever stored if that's smaller, and storing costs 5
+    // bytes for each 64 KB; every block but the last covers at least
+    // SYMBOLS_PER_BLOCK bytes, and there's room for an empty stored block
+    return length + (length >> 10) + 64;
+}
+
+// compress into a buffer with *prefix_length* bytes of room before the
+// compressed data and *suffix_length* after it
+static uint8_t *compress_into_new(const uint8_t *data, size_t length, int level, size_t prefix_length, size_t suffix_length,
+                                  size_t *compressed_length) {
+    deflater *d = deflater_create(level);
+    uint8_t *compressed = malloc(prefix_length + deflate_bound(length) + suffix_length);
+    if (d == NULL || compressed == NULL) {
+        fprintf(stderr, "Error allocating memory for compression.\n");
+        deflater_free(d);
+        free(compressed);
+        return NULL;
+    }
+    *compressed_length = deflater_compress(d, data, 0, length, true, compressed + prefix_length);
+    deflater_free(d);
+    return compressed;
+}
+
+uint8_t *deflate_compress(const uint8_t *data, size_t length, int level, size_t *result_length) {
+    uint8_t *compressed = compress_into_new(data, length, level, 0, 0, result_length);
+    if (compressed == NULL) {
+        return NULL;
+    }
+    uint8_t *shrunk = realloc(compressed, (*result_length > 0) ? *result_length : 1);
+    return (shrunk != NULL) ? shrunk : compressed;
+}
+
+// write the header and trailer around the *compressed_length* bytes of
+// compressed data *header_room* bytes into *member*, and trim it to fit
+static uint8_t *finish_member(uint8_t *member, size_t header_room, size_t compressed_length, int level, const char *name,
+                              uint32_t crc, size_t length, size_t *result_length) {
+    uint8_t XFL = (level == DEFLATE_MAX_LEVEL) ? 2 : (level == 1) ? 4 : 0; // name comes from RFC 1952
+    gzip_write_header(member, name, 0, XFL);
+    gzip_write_trailer(member + header_room + compressed_length, crc, (uint32_t)length);
+    *result_length = header_room + compressed_length + GZIP_TRAILER_LENGTH;
+    uint8_t *shrunk = realloc(member, *result_length);
+    return (shrunk != NULL) ? shrunk : member;
+}
+
+uint8_t *deflate_gzip(const uint8_t *data, size_t length, int level, const char *name, size_t *result_length) {
+    size_t header_room = GZIP_MIN_HEADER_LENGTH + ((name != NULL) ? strlen(name) + 1 : 0);
+    size_t compressed_length;
+    uint8_t *member = compress_into_new(data, length, level, header_room, GZIP_TRAILER_LENGTH, &compressed_length);
+    if (member == NULL) {
+        return NULL;
+    }
+    uint32_t crc = crc32_final(crc32_update(crc32_init(), data, length));
+    return finish_member(member, header_room, compressed_length, level, name, crc, length, result_length);
+}
+
+// Parallel compression
+
+typedef struct {
+    int level;
+    const uint8_t *data; // the start of the dictionary before the chunk
+    size_t dictionary_length;
+    size_t length;
+    bool final;
+    uint8_t *dest; // room for deflate_bound(length) bytes
+    size_t compressed_length;
+    uint32_t crc;
+    bool failed;
+    threadpool_task *task;
+} deflate_chunk;
+
+static void compress_chunk(void *argument) {
+    deflate_chunk *chunk = argument;
+    deflater *d = deflater_create(chunk->level);
+    if (d == NULL) {
+        chunk->failed = true;
+        return;
+    }
+    chunk->compressed_length = deflater_compress(d, chunk->data, chunk->dictionary_length, chunk->length, chunk->final, chunk->dest);
+    deflater_free(d);
+    chunk->crc = crc32_final(crc32_update(crc32_init(), chunk->data + chunk->dictionary_length, chunk->length));
+}
+
+uint8_t *deflate_gzip_parallel(const uint8_t *data, size_t length, int level, const char *name, int num_threads,
+                               size_t *result_length) {
+    if (num_threads < 2 || length <= DEFLATE_CHUNK_SIZE) {
+        return deflate_gzip(data, length, level, name, result_length);
+    }
+    size_t num_chunks = (length + DEFLATE_CHUNK_SIZE - 1) / DEFLATE_CHUNK_SIZE;
+    size_t chunk_room = deflate_bound(DEFLATE_CHUNK_SIZE);
+    size_t header_room = GZIP_MIN_HEADER_LENGTH + ((name != NULL) ? strlen(name) + 1 : 0);
+    deflate_chunk *chunks = calloc(num_chunks, sizeof(deflate_chunk));
+    uint8_t *member = malloc(header_room + num_chunks * chunk_room + GZIP_TRAILER_LENGTH);
+    threadpool *pool = (chunks != NULL && member != NULL) ? threadpool_create(num_threads) : NULL;
+    if (pool == NULL) {
+        fprintf(stderr, "Error allocating memory for compression.\n");
+        free(chunks);
+        free(member);
+        return NULL;
+    }
+
+    // each chunk is compressed into a slot of its own
+    for (size_t i = 0; i < num_chunks; i++) {
+        deflate_chunk *chunk = &chunks[i];
+        size_t start = i * DEFLATE_CHUNK_SIZE;
+        chunk->level = level;
+        chunk->dictionary_length = (start < WINDOW_SIZE) ? start : WINDOW_SIZE;
+        chunk->data = data + start - chunk->dictionary_length;
+        chunk->length = (length - start < DEFLATE_CHUNK_SIZE) ? length - start : DEFLATE_CHUNK_SIZE;
+        chunk->final = (i == num_chunks - 1);
+        chunk->dest = member + header_room + i * chunk_room;
+        chunk->task = threadpool_submit(pool, compress_chunk, chunk);
+        if (chunk->task == NULL) {
+            compress_chunk(chunk);
+        }
+    }
+
+    // then slid down to follow on from the one before it
+    size_t compressed_length = 0;
+    uint32_t crc = 0; // of no data at all
+    bool failed = false;
+    for (size_t i = 0; i < num_chunks; i++) {
+        deflate_chunk *chunk = &chunks[i];
+        if (chunk->task != NULL) {
+            threadpool_join(pool, chunk->task);
+        }
+        failed = failed || chunk->failed;
+        memmove(member + header_room + compressed_length, chunk->dest, chunk->compressed_length);
+        compressed_length += chunk->compressed_length;
+        crc = crc32_combine_length(crc, chunk->crc, chunk->length);
+    }
+    threadpool_free(pool);
+    free(chunks);
+    if (failed) {
+        fprintf(stderr, "Error allocating memory for compression.\n");
+        free(member);
+        return NULL;
+    }
+    return finish_member(member, header_room, compressed_length, level, name, crc, length, result_length);
+}
@@ -0,0 +1,79 @@
+//
+//  deflate.h
+//  nflate
+//
+//  Copyright (c) 2020 David Kopec
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+// The compressing side of DEFLATE (RFC 1951), with the usual levels:
+// 0 only stores the data, 1 to 3 take the first match a hash table turns up
+// without looking any further, and 4 to 9 follow ever longer chains of earlier
+// positions with the same hash and hold off on a match in case the next
+// position has a longer one (lazy matching). Each block is written with
+// whichever of dynamic codes, the fixed codes or no compression is smallest.
+
+#ifndef deflate_h
+#define deflate_h
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define DEFLATE_MIN_LEVEL 0
+#define DEFLATE_MAX_LEVEL 9
+#define DEFLATE_DEFAULT_LEVEL 6
+
+// the most bytes compressing *length* bytes can take, when compressed in one call
+size_t deflate_bound(size_t length);
+
+typedef struct deflater deflater;
+
+// set up to compress at *level*; a deflater holds a few hundred KB of tables and
+// can be used for one call after another, but only by one thread at a time
+// returns NULL if out of memory
+deflater *deflater_create(int level);
+
+// compress the *length* bytes of *data* after the first *dictionary_length*,
+// which matches may refer back to, into *dest*, which has room for at least
+// deflate_bound(length) bytes
+// if *final* is set the last block is marked as the final one; otherwise the
+// output ends with an empty stored block, so it ends on a byte boundary and
+// the compressed data of what comes next can be appended to it
+// returns the number of bytes written
+size_t deflater_compress(deflater *d, const uint8_t *data, size_t dictionary_length, size_t length, bool final, uint8_t *dest);
+
+void deflater_free(deflater *d);
+
+// compress *length* bytes of *data* at *level* into raw DEFLATE data
+// *result_length* is a pointer to a place to hold the length of the compressed data
+// returns the compressed data, or NULL if out of memory
+uint8_t *deflate_compress(const uint8_t *data, size_t length, int level, size_t *result_length);
+
+// like deflate_compress(), but the compressed data is wrapped in a gzip member
+// with *name* as its FNAME, or none if *name* is NULL
+uint8_t *deflate_gzip(const uint8_t *data, size_t length, int level, const char *name, size_t *result_length);
+
+// Parallel compression
+// As pigz does, the data is split into chunks that are compressed on several
+// threads at once. Each chunk is primed with the 32 KB before it, so matches
+// still reach back across the seams, and all but the last end on a byte
+// boundary, so they join into one member that any inflater can read.
+#define DEFLATE_CHUNK_SIZE (1024 * 1024) // bytes of input per chunk
+
+// like deflate_gzip(), but compressed on *num_threads* threads; the CRC-32s of
+// the chunks are combined for the trailer
+uint8_t *deflate_gzip_parallel(const uint8_t *data, size_t length, int level, const char *name, int num_threads,
+                               size_t *result_length);
+
+#endif /* deflate_h */
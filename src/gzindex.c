@@ -0,0 +1,389 @@
+//
+//  gzindex.c
+//  nflate
+//
+//  Copyright (c) 2020 David Kopec
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gzindex.h"
+#include "nflate.h"
+
+#define TRAILER_LENGTH 8
+#define WALK_BUFFER_SIZE 65536
+#define INDEX_MAGIC "NFIX"
+#define INDEX_VERSION 1
+
+// Both building an index and extracting from one inflate forward from an
+// access point through the rest of its member and the members after it, with
+// the streaming interface so only the window is ever held in memory
+typedef struct walk walk;
+struct walk {
+    gzipfile *gzf;
+    // hands over the next piece of output, which starts at *position*; returns false to stop
+    bool (*output)(walk *w, uint64_t position, const uint8_t *data, size_t length);
+    nflate_block_callback on_block; // NULL unless building
+    uint64_t bit_base; // bit offset in the file of the first byte fed to the current stream
+    uint64_t output_base; // uncompressed offset of the first byte of the current stream's output
+    uint64_t output_position; // uncompressed offset of the next byte of output
+
+    // building
+    gzindex *index;
+    uint64_t span;
+    bool out_of_memory;
+
+    // extracting
+    uint64_t offset;
+    uint8_t *dest;
+    size_t length;
+    size_t copied;
+};
+
+static bool walk_members(walk *w, const gzindex_point *start) {
+    gzipfile *gzf = w->gzf;
+    uint8_t *buffer = malloc(WALK_BUFFER_SIZE);
+    if (buffer == NULL) {
+        fprintf(stderr, "Error allocating memory for output.\n");
+        return false;
+    }
+    size_t position = (size_t)(start->bit_offset / 8);
+    int skip_bits = (int)(start->bit_offset % 8);
+    const uint8_t *window = start->window;
+    size_t window_length = start->window_length;
+    w->output_position = start->uncompressed_offset;
+
+    bool success = false;
+    for (;;) {
+        nflate_stream *s = nflate_stream_init();
+        if (s == NULL) {
+            fprintf(stderr, "Error allocating memory for stream.\n");
+            break;
+        }
+        nflate_stream_prime(s, skip_bits, window, window_length);
+        if (w->on_block != NULL) {
+            nflate_stream_on_block(s, w->on_block, w);
+        }
+        w->bit_base = (uint64_t)position * 8;
+        w->output_base = w->output_position;
+        // with no output before the start, the CRC covers the whole member
+        bool whole_member = (window_length == 0);
+
+        nflate_status status;
+        bool stopped = false;
+        do {
+            position += nflate_stream_feed(s, gzf->contents + position, gzf->contents_length - position);
+            size_t produced;
+            do {
+                status = nflate_stream_drain(s, buffer, WALK_BUFFER_SIZE, &produced);
+                if (produced > 0 && !w->output(w, w->output_position, buffer, produced)) {
+                    stopped = true;
+                    break;
+                }
+                w->output_position += produced;
+            } while (status == NFLATE_OK);
+        } while (!stopped && status == NFLATE_NEEDS_INPUT && position < gzf->contents_length);
+
+        size_t end = position - nflate_stream_unused_input(s, NULL);
+        uint32_t crc = nflate_stream_crc32(s);
+        nflate_stream_end(s);
+        if (stopped) {
+            success = true;
+            break;
+        }
+        if (status != NFLATE_DONE) {
+            if (status == NFLATE_NEEDS_INPUT) {
+                fprintf(stderr, "Error, compressed data ended before the final block.\n");
+            }
+            break;
+        }
+        if (gzf->contents_length - end < TRAILER_LENGTH) {
+            fprintf(stderr, "Error, member is missing its trailer.\n");
+            break;
+        }
+        if (whole_member && crc != gzip_read_le32(gzf->contents + end)) {
+            fprintf(stderr, "CRC32 check did not pass on data.\n");
+            break;
+        }
+        if (whole_member && (uint32_t)(w->output_position - w->output_base) != gzip_read_le32(gzf->contents + end + 4)) {
+            fprintf(stderr, "ISIZE check did not pass on data.\n");
+            break;
+        }
+
+        // move on to the next member, if there is one
+        end += TRAILER_LENGTH;
+        size_t header_length = gzip_header_length(gzf->contents + end, gzf->contents_length - end);
+        if (header_length == 0) {
+            success = true; // the end of the file, or trailing garbage
+            break;
+        }
+        position = end + header_length;
+        skip_bits = 0;
+        window = NULL;
+        window_length = 0;
+    }
+    free(buffer);
+    return success;
+}
+
+static bool count_output(walk *w, uint64_t position, const uint8_t *data, size_t length) {
+    (void)w;
+    (void)position;
+    (void)data;
+    (void)length;
+    return true;
+}
+
+// record an access point at the start of every member, and at the first block
+// that starts at least span bytes after the last access point
+static void record_point(uint64_t bit_position, uint64_t uncompressed_position, const uint8_t *window, size_t window_length, void *context) {
+    walk *w = context;
+    gzindex *index = w->index;
+    uint64_t offset = w->output_base + uncompressed_position;
+    if (index->num_points > 0 && window_length > 0 && offset - index->points[index->num_points - 1].uncompressed_offset < w->span) {
+        return;
+    }
+    if (index->num_points == index->capacity) {
+        size_t capacity = (index->capacity > 0) ? index->capacity * 2 : 64;
+        gzindex_point *grown = realloc(index->points, capacity * sizeof(gzindex_point));
+        if (grown == NULL) {
+            w->out_of_memory = true;
+            return;
+        }
+        index->points = grown;
+        index->capacity = capacity;
+    }
+    gzindex_point *point = &index->points[index->num_points];
+    point->bit_offset = w->bit_base + bit_position;
+    point->uncompressed_offset = offset;
+    point->window_length = (uint32_t)window_length;
+    point->window = NULL;
+    if (window_length > 0) {
+        point->window = malloc(window_length);
+        if (point->window == NULL) {
+            w->out_of_memory = true;
+            return;
+        }
+        memcpy(point->window, window, window_length);
+    }
+    index->num_points++;
+}
+
+// access point at the start of the first member's DEFLATE data
+static gzindex_point first_point(const gzipfile *gzf) {
+    gzindex_point point = {(uint64_t)(gzf->data - gzf->contents) * 8, 0, 0, NULL};
+    return point;
+}
+
+gzindex *gzindex_build(gzipfile *gzf, uint64_t span) {
+    gzindex *index = calloc(1, sizeof(gzindex));
+    if (index == NULL) {
+        return NULL;
+    }
+    walk w;
+    memset(&w, 0, sizeof(walk));
+    w.gzf = gzf;
+    w.output = count_output;
+    w.on_block = record_point;
+    w.index = index;
+    w.span = (span > 0) ? span : GZINDEX_DEFAULT_SPAN;
+
+    gzindex_point start = first_point(gzf);
+    bool success = walk_members(&w, &start);
+    if (w.out_of_memory) {
+        fprintf(stderr, "Error allocating memory for index.\n");
+        success = false;
+    }
+    if (!success) {
+        gzindex_free(index);
+        return NULL;
+    }
+    index->compressed_length = gzf->contents_length;
+    index->uncompressed_length = w.output_position;
+    return index;
+}
+
+void gzindex_free(gzindex *index) {
+    if (index == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < index->num_points; i++) {
+        free(index->points[i].window);
+    }
+    free(index->points);
+    free(index);
+}
+
+static void write_le(FILE *file, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        fputc((int)((value >> (8 * i)) & 0xFF), file);
+    }
+}
+
+static bool read_le(FILE *file, uint64_t *value, int bytes) {
+    *value = 0;
+    for (int i = 0; i < bytes; i++) {
+        int byte = fgetc(file);
+        if (byte == EOF) {
+            return false;
+        }
+        *value |= (uint64_t)byte << (8 * i);
+    }
+    return true;
+}
+
+// File layout, all numbers little-endian:
+// "NFIX", version (4 bytes), compressed length, uncompressed length, number of points (8 bytes each)
+// then for each point: bit offset, uncompressed offset (8 bytes each), window length (4 bytes), window
+bool gzindex_write(const gzindex *index, const char *name) {
+    FILE *file = fopen(name, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Can't open %s\n", name);
+        return false;
+    }
+    fwrite(INDEX_MAGIC, 1, 4, file);
+    write_le(file, INDEX_VERSION, 4);
+    write_le(file, index->compressed_length, 8);
+    write_le(file, index->uncompressed_length, 8);
+    write_le(file, index->num_points, 8);
+    for (size_t i = 0; i < index->num_points; i++) {
+        const gzindex_point *point = &index->points[i];
+        write_le(file, point->bit_offset, 8);
+        write_le(file, point->uncompressed_offset, 8);
+        write_le(file, point->window_length, 4);
+        if (point->window_length > 0) {
+            fwrite(point->window, 1, point->window_length, file);
+        }
+    }
+    bool success = !ferror(file);
+    if (fclose(file) != 0) {
+        success = false;
+    }
+    if (!success) {
+        fprintf(stderr, "Error writing to %s\n", name);
+    }
+    return success;
+}
+
+gzindex *gzindex_read(const char *name) {
+    FILE *file = fopen(name, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+    gzindex *index = calloc(1, sizeof(gzindex));
+    if (index == NULL) {
+        fclose(file);
+        return NULL;
+    }
+    char magic[4];
+    uint64_t version, num_points;
+    if (fread(magic, 1, 4, file) != 4 || memcmp(magic, INDEX_MAGIC, 4) != 0 ||
+        !read_le(file, &version, 4) || version != INDEX_VERSION ||
+        !read_le(file, &index->compressed_length, 8) ||
+        !read_le(file, &index->uncompressed_length, 8) ||
+        !read_le(file, &num_points, 8)) {
+        goto error;
+    }
+    for (uint64_t i = 0; i < num_points; i++) {
+        gzindex_point point = {0, 0, 0, NULL};
+        uint64_t window_length;
+        if (!read_le(file, &point.bit_offset, 8) ||
+            !read_le(file, &point.uncompressed_offset, 8) ||
+            !read_le(file, &window_length, 4) || window_length > 32768) {
+            goto error;
+        }
+        point.window_length = (uint32_t)window_length;
+        if (window_length > 0) {
+            point.window = malloc(window_length);
+            if (point.window == NULL || fread(point.window, 1, window_length, file) != window_length) {
+                free(point.window);
+                goto error;
+            }
+        }
+        if (index->num_points == index->capacity) {
+            size_t capacity = (index->capacity > 0) ? index->capacity * 2 : 64;
+            gzindex_point *grown = realloc(index->points, capacity * sizeof(gzindex_point));
+            if (grown == NULL) {
+                free(point.window);
+                goto error;
+            }
+            index->points = grown;
+            index->capacity = capacity;
+        }
+        index->points[index->num_points++] = point;
+    }
+    fclose(file);
+    return index;
+
+error:
+    fprintf(stderr, "%s is not a valid index.\n", name);
+    fclose(file);
+    gzindex_free(index);
+    return NULL;
+}
+
+// copy the part of each piece of output that falls in the requested range
+static bool copy_range(walk *w, uint64_t position, const uint8_t *data, size_t length) {
+    uint64_t end = position + length;
+    if (end > w->offset) {
+        size_t skip = (position < w->offset) ? (size_t)(w->offset - position) : 0;
+        size_t amount = length - skip;
+        if (amount > w->length - w->copied) {
+            amount = w->length - w->copied;
+        }
+        memcpy(w->dest + w->copied, data + skip, amount);
+        w->copied += amount;
+    }
+    return w->copied < w->length;
+}
+
+bool gzindex_extract(gzipfile *gzf, const gzindex *index, uint64_t offset, uint8_t *dest, size_t length, size_t *copied) {
+    *copied = 0;
+    if (length == 0) {
+        return true;
+    }
+    gzindex_point start = first_point(gzf);
+    if (index != NULL) {
+        if (index->compressed_length != gzf->contents_length) {
+            fprintf(stderr, "Error, the index was built for a different file.\n");
+            return false;
+        }
+        // binary search for the last access point at or before offset
+        size_t low = 0;
+        size_t high = index->num_points;
+        while (low < high) {
+            size_t middle = low + (high - low) / 2;
+            if (index->points[middle].uncompressed_offset <= offset) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        if (low > 0) {
+            start = index->points[low - 1];
+        }
+    }
+
+    walk w;
+    memset(&w, 0, sizeof(walk));
+    w.gzf = gzf;
+    w.output = copy_range;
+    w.offset = offset;
+    w.dest = dest;
+    w.length = length;
+    bool success = walk_members(&w, &start);
+    *copied = w.copied;
+    return success;
+}
@@ -0,0 +1,73 @@
+//
+//  gzindex.h
+//  nflate
+//
+//  Copyright (c) 2020 David Kopec
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+// Random access into gzip files
+// DEFLATE data can only be decoded from the start of a block, and only with
+// the 32 KB of output before that block at hand for back-references. An index
+// remembers both every so often so decoding can start close to any offset in
+// the uncompressed data instead of at the start of the file.
+
+#ifndef gzindex_h
+#define gzindex_h
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "gzipfile.h"
+
+#define GZINDEX_DEFAULT_SPAN (1 << 22) // uncompressed bytes between access points
+
+typedef struct {
+    uint64_t bit_offset; // first bit of a block, counting from the start of the file
+    uint64_t uncompressed_offset; // output that comes before that block, across all members
+    uint32_t window_length; // 0 at the start of a member
+    uint8_t *window; // the output right before the block
+} gzindex_point;
+
+typedef struct {
+    uint64_t compressed_length; // size of the file the index was built from
+    uint64_t uncompressed_length;
+    size_t num_points;
+    size_t capacity;
+    gzindex_point *points; // in order of offset
+} gzindex;
+
+// inflate all of *gzf*, recording an access point at the start of every
+// member and at the first block boundary after every *span* bytes of output
+// returns NULL if the file couldn't be inflated
+gzindex *gzindex_build(gzipfile *gzf, uint64_t span);
+
+void gzindex_free(gzindex *index);
+
+// save *index* to the file *name*
+// returns false if the file couldn't be written
+bool gzindex_write(const gzindex *index, const char *name);
+
+// load an index saved by gzindex_write()
+// returns NULL if the file can't be read or isn't an index
+gzindex *gzindex_read(const char *name);
+
+// copy up to *length* bytes of uncompressed data starting *offset* bytes into
+// the output of *gzf* to *dest*, starting from the nearest access point in
+// *index* before *offset*, or from the start of the file if *index* is NULL
+// *copied* is a pointer to a place to hold how many bytes were copied, which is
+// less than *length* only at the end of the data
+// returns false if the data couldn't be inflated
+bool gzindex_extract(gzipfile *gzf, const gzindex *index, uint64_t offset, uint8_t *dest, size_t length, size_t *copied);
+
+#endif /* gzindex_h */
@@ -19,8 +19,136 @@
 // Based on RFC 1952
 // https://tools.ietf.org/html/rfc1952
 
+#ifndef _WIN32
+#define _DEFAULT_SOURCE // for madvise()
+#endif
+
 #include "gzipfile.h"
 #include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define ID1_GZIP 31
+#define ID2_GZIP 139
+#define CM_DEFLATE 8
+#define FIXED_HEADER_LENGTH 10
+#define OS_UNKNOWN 255
+#define READ_CHUNK_SIZE 65536 // first read size when a file has to be read rather than mapped
+
+// Files are mapped into memory when possible, so the decoder reads straight
+// from the page cache with no copying; pipes and other files that can't be
+// mapped are read into a buffer instead
+
+#ifdef _WIN32
+
+static bool map_file(const char *name, gzipfile *gzf) {
+    HANDLE file = CreateFileA(name, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER size;
+    if (GetFileType(file) != FILE_TYPE_DISK || !GetFileSizeEx(file, &size) || size.QuadPart == 0 ||
+        (unsigned long long)size.QuadPart > (size_t)-1) {
+        CloseHandle(file);
+        return false;
+    }
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (mapping == NULL) {
+        return false;
+    }
+    void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping); // the view keeps the mapping alive
+    if (view == NULL) {
+        return false;
+    }
+    gzf->contents = view;
+    gzf->contents_length = (size_t)size.QuadPart;
+    gzf->mapped = true;
+    return true;
+}
+
+static void unmap_file(gzipfile *gzf) {
+    UnmapViewOfFile(gzf->contents);
+}
+
+#else
+
+static bool map_file(const char *name, gzipfile *gzf) {
+    int file = open(name, O_RDONLY);
+    if (file < 0) {
+        return false;
+    }
+    struct stat info;
+    if (fstat(file, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size == 0 ||
+        (unsigned long long)info.st_size > (size_t)-1) {
+        close(file);
+        return false;
+    }
+    size_t length = (size_t)info.st_size;
+    void *map = mmap(NULL, length, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file); // the mapping stays valid after the file is closed
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    // the data is mostly read front to back, so have the kernel read ahead aggressively
+    madvise(map, length, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+    madvise(map, length, MADV_HUGEPAGE);
+#endif
+    gzf->contents = map;
+    gzf->contents_length = length;
+    gzf->mapped = true;
+    return true;
+}
+
+static void unmap_file(gzipfile *gzf) {
+    munmap(gzf->contents, gzf->contents_length);
+}
+
+#endif
+
+// read all of *input* into memory, for files that can't be mapped
+// pipes don't know their length up front, so the buffer doubles as it fills
+static bool read_file(FILE *input, gzipfile *gzf) {
+    size_t capacity = READ_CHUNK_SIZE;
+    uint8_t *buffer = malloc(capacity);
+    size_t length = 0;
+    while (buffer != NULL) {
+        length += fread(buffer + length, 1, capacity - length, input);
+        if (length < capacity) {
+            break; // end of file or an error
+        }
+        capacity *= 2;
+        uint8_t *grown = realloc(buffer, capacity);
+        if (grown == NULL) {
+            free(buffer);
+        }
+        buffer = grown;
+    }
+    if (buffer == NULL) {
+        fprintf(stderr, "Error allocating memory for data.");
+        return false;
+    }
+    if (ferror(input)) {
+        fprintf(stderr, "Error reading data from file.");
+        free(buffer);
+        return false;
+    }
+    gzf->contents = buffer;
+    gzf->contents_length = length;
+    return true;
+}
 
 void free_gzfipfile(gzipfile *gzf) {
     if (gzf->FEXTRA != NULL) {
@@ -32,116 +160,230 @@ void free_gzfipfile(gzipfile *gzf) {
     if (gzf->FCOMMENT != NULL) {
         free(gzf->FCOMMENT);
     }
+    if (gzf->mapped) {
+        unmap_file(gzf);
+    } else {
+        free(gzf->contents);
+    }
     free(gzf);
 }
 
-gzipfile *read_gzipfile(const char *name) {
-    FILE *input = fopen(name, "rb");
-    if (!input) {
-        fprintf(stderr, "Can't open %s\n", name);
-        return NULL;
+uint32_t gzip_read_le32(const uint8_t *data) {
+    return (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+// copy the zero-terminated string starting at *data*[*i*] into *copy* if it
+// isn't NULL, moving *i* past it
+// returns false if the string runs past *length*
+static bool read_string(const uint8_t *data, size_t length, size_t *i, char **copy) {
+    const uint8_t *end = memchr(data + *i, '\0', length - *i);
+    if (end == NULL) {
+        return false;
     }
-    
-    gzipfile *gzf = calloc(1, sizeof(gzipfile));
-    
-    // IDs must be write to be valid gzip file
-    gzf->header.ID1 = fgetc(input);
-    if (gzf->header.ID1 != 31) { goto error; }
-    gzf->header.ID2 = fgetc(input);
-    if (gzf->header.ID2 != 139) { goto error; }
-    gzf->header.CM = fgetc(input);
-    uint8_t flags = fgetc(input);
-    gzf->header.FLG.FTEXT = flags & 1;
-    gzf->header.FLG.FHCRC = flags & 2;
-    gzf->header.FLG.FEXTRA = flags & 4;
-    gzf->header.FLG.FNAME = flags & 8;
-    gzf->header.FLG.FCOMMENT = flags & 16;
-    fread(&gzf->header.MTIME, 4, 1, input);
-    gzf->header.XFL = fgetc(input);
-    gzf->header.OS = fgetc(input);
-    
-    if (gzf->header.FLG.FEXTRA) {
-        uint16_t XLEN = 0;
-        fread(&XLEN, 2, 1, input);
-        gzf->FEXTRA = calloc(1, XLEN);
-        fread(gzf->FEXTRA, 1, XLEN, input);
-    }
-    
-    if (gzf->header.FLG.FNAME) {
-        char temp;
-        size_t length = 1;
-        char *buffer = malloc(length);
-        size_t i = 0;
-        do {
-            if (i >= length) {
-                length *= 2;
-                buffer = realloc(buffer, length);
+    size_t string_length = (size_t)(end - (data + *i)) + 1;
+    if (copy != NULL) {
+        *copy = malloc(string_length);
+        if (*copy != NULL) {
+            memcpy(*copy, data + *i, string_length);
+        }
+    }
+    *i += string_length;
+    return true;
+}
+
+// parse the member header at the start of *data*, filling in *gzf* if it isn't NULL
+// returns the length of the header, 0 if it is invalid, or
+// GZIP_HEADER_INCOMPLETE if *data* ends before the header does
+static size_t parse_header(const uint8_t *data, size_t length, gzipfile *gzf) {
+    // IDs must be right to be valid gzip file
+    const uint8_t expected[3] = {ID1_GZIP, ID2_GZIP, CM_DEFLATE};
+    for (size_t i = 0; i < 3; i++) {
+        if (i >= length) {
+            return GZIP_HEADER_INCOMPLETE;
+        }
+        if (data[i] != expected[i]) {
+            return 0;
+        }
+    }
+    if (length < 4) {
+        return GZIP_HEADER_INCOMPLETE;
+    }
+    uint8_t flags = data[3];
+    if (flags & 0xE0) { // reserved bits must be zero
+        return 0;
+    }
+    if (length < FIXED_HEADER_LENGTH) {
+        return GZIP_HEADER_INCOMPLETE;
+    }
+    if (gzf != NULL) {
+        gzf->header.ID1 = data[0];
+        gzf->header.ID2 = data[1];
+        gzf->header.CM = data[2];
+        gzf->header.FLG.FTEXT = flags & 1;
+        gzf->header.FLG.FHCRC = flags & 2;
+        gzf->header.FLG.FEXTRA = flags & 4;
+        gzf->header.FLG.FNAME = flags & 8;
+        gzf->header.FLG.FCOMMENT = flags & 16;
+        gzf->header.MTIME = gzip_read_le32(data + 4);
+        gzf->header.XFL = data[8];
+        gzf->header.OS = data[9];
+    }
+    size_t i = FIXED_HEADER_LENGTH;
+
+    if (flags & 4) { // FEXTRA
+        if (length - i < 2) {
+            return GZIP_HEADER_INCOMPLETE;
+        }
+        size_t XLEN = data[i] | (data[i + 1] << 8);
+        i += 2;
+        if (length - i < XLEN) {
+            return GZIP_HEADER_INCOMPLETE;
+        }
+        if (gzf != NULL) {
+            gzf->FEXTRA = calloc(1, XLEN > 0 ? XLEN : 1);
+            if (gzf->FEXTRA != NULL) {
+                memcpy(gzf->FEXTRA, data + i, XLEN);
             }
-            temp = fgetc(input);
-            if (temp == EOF) {
+        }
+        i += XLEN;
+    }
+
+    if (flags & 8) { // FNAME
+        if (!read_string(data, length, &i, (gzf != NULL) ? &gzf->FNAME : NULL)) {
+            if (gzf != NULL) {
                 fprintf(stderr, "Unexpectedly found EOF while reading FNAME.");
-                goto error;
-            }
-            buffer[i] = temp;
-            i++;
-        } while(temp != '\0');
-        gzf->FNAME = realloc(buffer, i);
-    }
-    
-    if (gzf->header.FLG.FCOMMENT) {
-        char temp;
-        size_t length = 1;
-        char *buffer = malloc(length);
-        size_t i = 0;
-        do {
-            if (i >= length) {
-                length *= 2;
-                buffer = realloc(buffer, length);
             }
-            temp = fgetc(input);
-            if (temp == EOF) {
+            return GZIP_HEADER_INCOMPLETE;
+        }
+    }
+
+    if (flags & 16) { // FCOMMENT
+        if (!read_string(data, length, &i, (gzf != NULL) ? &gzf->FCOMMENT : NULL)) {
+            if (gzf != NULL) {
                 fprintf(stderr, "Unexpectedly found EOF while reading FCOMMENT.");
-                goto error;
             }
-            buffer[i] = temp;
-            i++;
-        } while(temp != '\0');
-        gzf->FCOMMENT = realloc(buffer, i);
-    }
-    
-    if (gzf->header.FLG.FHCRC) {
-        fread(&gzf->FHCRC, 2, 1, input);
-    }
-    
-    long int data_start = ftell(input);
-    if (fseek(input, -8, SEEK_END) != 0){
-        fprintf(stderr, "Error seeking to end of data block.");
-    }
-    long int data_end = ftell(input);
-    if (fseek(input, data_start, SEEK_SET) != 0) {
-        fprintf(stderr, "Error seeking to start of data block.");
-    }
-    size_t data_size = data_end - data_start;
-    gzf->data = malloc(data_size);
-    if (!gzf->data) {
-        fprintf(stderr, "Error allocating memory for data.");
-        goto error;
+            return GZIP_HEADER_INCOMPLETE;
+        }
     }
-    gzf->data_length = data_size;
-    size_t amountRead = fread(gzf->data, 1, data_size, input);
-    if (amountRead != data_size) {
-        fprintf(stderr, "Error reading data from file.");
-        goto error;
+
+    if (flags & 2) { // FHCRC
+        if (length - i < 2) {
+            return GZIP_HEADER_INCOMPLETE;
+        }
+        if (gzf != NULL) {
+            gzf->FHCRC = (uint16_t)(data[i] | (data[i + 1] << 8));
+        }
+        i += 2;
     }
-    fread(&gzf->CRC32, 4, 1, input);
-    fread(&gzf->ISIZE, 4, 1, input);
-    
+    return i;
+}
+
+size_t gzip_header_length(const uint8_t *data, size_t length) {
+    size_t header_length = parse_header(data, length, NULL);
+    return (header_length == GZIP_HEADER_INCOMPLETE) ? 0 : header_length;
+}
+
+size_t gzip_header_scan(const uint8_t *data, size_t length) {
+    return parse_header(data, length, NULL);
+}
+
+// map or read all of the file *name* into gzf->contents
+static bool load_file(const char *name, gzipfile *gzf) {
+    if (map_file(name, gzf)) {
+        return true;
+    }
+    FILE *input = fopen(name, "rb");
+    if (!input) {
+        fprintf(stderr, "Can't open %s\n", name);
+        return false;
+    }
+    bool read = read_file(input, gzf);
     fclose(input);
-    
+    return read;
+}
+
+gzipfile *read_gzipfile(const char *name) {
+    gzipfile *gzf = calloc(1, sizeof(gzipfile));
+    if (gzf == NULL) {
+        return NULL;
+    }
+
+    // the members can only be found by inflating them one after another, so
+    // the whole file needs to be at hand
+    if (!load_file(name, gzf)) {
+        free(gzf);
+        return NULL;
+    }
+
+    if (!gzip_parse_file(gzf)) {
+        free_gzfipfile(gzf);
+        return NULL;
+    }
     return gzf;
-    
-error:
-    fclose(input);
-    free_gzfipfile(gzf);
-    return NULL;
+}
+
+bool gzip_parse_file(gzipfile *gzf) {
+    size_t header_length = parse_header(gzf->contents, gzf->contents_length, gzf);
+    if (header_length == 0 || header_length == GZIP_HEADER_INCOMPLETE) {
+        return false;
+    }
+    gzf->data = gzf->contents + header_length;
+    gzf->data_length = gzf->contents_length - header_length;
+    if (gzf->data_length >= 8) {
+        gzf->CRC32 = gzip_read_le32(gzf->contents + gzf->contents_length - 8);
+        gzf->ISIZE = gzip_read_le32(gzf->contents + gzf->contents_length - 4);
+    }
+    return true;
+}
+
+gzipfile *read_plain_file(const char *name) {
+    gzipfile *gzf = calloc(1, sizeof(gzipfile));
+    if (gzf == NULL) {
+        return NULL;
+    }
+    bool loaded;
+    if (name == NULL) {
+#ifdef _WIN32
+        _setmode(_fileno(stdin), _O_BINARY);
+#endif
+        loaded = read_file(stdin, gzf);
+    } else {
+        loaded = load_file(name, gzf);
+    }
+    if (!loaded) {
+        free(gzf);
+        return NULL;
+    }
+    gzf->data = gzf->contents;
+    gzf->data_length = gzf->contents_length;
+    return gzf;
+}
+
+static void write_le32(uint8_t *dest, uint32_t value) {
+    dest[0] = (uint8_t)value;
+    dest[1] = (uint8_t)(value >> 8);
+    dest[2] = (uint8_t)(value >> 16);
+    dest[3] = (uint8_t)(value >> 24);
+}
+
+size_t gzip_write_header(uint8_t *dest, const char *FNAME, uint32_t MTIME, uint8_t XFL) {
+    dest[0] = ID1_GZIP;
+    dest[1] = ID2_GZIP;
+    dest[2] = CM_DEFLATE;
+    dest[3] = (FNAME != NULL) ? 8 : 0;
+    write_le32(dest + 4, MTIME);
+    dest[8] = XFL;
+    dest[9] = OS_UNKNOWN;
+    size_t length = FIXED_HEADER_LENGTH;
+    if (FNAME != NULL) {
+        size_t name_length = strlen(FNAME) + 1;
+        memcpy(dest + length, FNAME, name_length);
+        length += name_length;
+    }
+    return length;
+}
+
+void gzip_write_trailer(uint8_t *dest, uint32_t CRC32, uint32_t ISIZE) {
+    write_le32(dest, CRC32);
+    write_le32(dest + 4, ISIZE);
 }
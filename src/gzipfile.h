@@ -46,15 +46,20 @@ typedef struct {
     uint8_t OS;
 } gzipheader;
 
+// A gzip file held in memory. The header fields are those of the first
+// member; a file may hold several members one after another (RFC 1952 2.2).
 typedef struct {
     gzipheader header;
     char *FEXTRA;
     char *FNAME;
     char *FCOMMENT;
     uint16_t FHCRC;
-    uint8_t *data;
+    uint8_t *contents; // the whole file, read-only if mapped
+    size_t contents_length;
+    bool mapped; // contents is a memory mapping of the file rather than a buffer
+    uint8_t *data; // everything after the first member's header
     size_t data_length;
-    uint32_t CRC32;
+    uint32_t CRC32; // trailer of the last member
     uint32_t ISIZE;
 } gzipfile;
 
@@ -62,4 +67,42 @@ void free_gzfipfile(gzipfile *gzf);
 
 gzipfile *read_gzipfile(const char *name);
 
+// length of the member header at the start of *data*, which is *length* bytes long
+// returns 0 if *data* doesn't start with a complete, valid header
+size_t gzip_header_length(const uint8_t *data, size_t length);
+
+#define GZIP_HEADER_INCOMPLETE ((size_t)-1)
+
+// like gzip_header_length(), but tells a header that is cut off by the end of
+// *data* apart from an invalid one, for reading headers as input arrives
+// returns GZIP_HEADER_INCOMPLETE if more bytes are needed to tell
+size_t gzip_header_scan(const uint8_t *data, size_t length);
+
+// read a little-endian 32-bit trailer field
+uint32_t gzip_read_le32(const uint8_t *data);
+
+// read all of the file *name*, or standard input if it is NULL, without
+// looking for a header, for data that is about to be compressed
+// contents and data both hold all of it
+gzipfile *read_plain_file(const char *name);
+
+// fill in the header fields and data of *gzf*, read by read_plain_file(), from
+// the header of the member it starts with
+// returns false if it doesn't start with a valid header
+bool gzip_parse_file(gzipfile *gzf);
+
+// Writing members
+
+#define GZIP_MIN_HEADER_LENGTH 10
+#define GZIP_TRAILER_LENGTH 8
+
+// write a member header to *dest*, which needs room for GZIP_MIN_HEADER_LENGTH
+// bytes plus the length of *FNAME* and its terminator, if it isn't NULL
+// *XFL* is 2 for data compressed as tightly as possible, 4 for the fastest, or 0
+// returns the length of the header
+size_t gzip_write_header(uint8_t *dest, const char *FNAME, uint32_t MTIME, uint8_t XFL);
+
+// write the GZIP_TRAILER_LENGTH bytes of a member trailer to *dest*
+void gzip_write_trailer(uint8_t *dest, uint32_t CRC32, uint32_t ISIZE);
+
 #endif /* gzipfile_h */
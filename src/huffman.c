@@ -0,0 +1,312 @@
+//
+//  huffman.c
+//  nflate
+//
+//  Copyright (c) 2020 David Kopec
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include <stdlib.h>
+#include <string.h>
+#include "huffman.h"
+
+// Based on RFC 1951 section 3.2.2
+// https://tools.ietf.org/html/rfc1951
+
+#define MAX_ROOT_BITS 12
+
+// Huffman codes are packed starting with their most significant bit, but the
+// bitstream hands us bits starting with the first one read, so table indices
+// are the codes reversed
+static uint16_t reverse_bits(uint16_t code, int length) {
+    uint16_t reversed = 0;
+    for (int i = 0; i < length; i++) {
+        reversed = (reversed << 1) | (code & 1);
+        code >>= 1;
+    }
+    return reversed;
+}
+
+// code adapted from RFC 1951 section 3.2.2
+// https://tools.ietf.org/html/rfc1951
+void huffman_canonical_codes(const uint8_t *code_lengths, int num_symbols, uint16_t *codes) {
+    int bl_count[HUFFMAN_MAX_BITS + 1] = {0};
+    for (int i = 0; i < num_symbols; i++) {
+        bl_count[code_lengths[i]]++;
+    }
+
+    uint16_t code = 0;
+    bl_count[0] = 0;
+    uint16_t next_code[HUFFMAN_MAX_BITS + 1] = {0};
+    for (int bits = 1; bits <= HUFFMAN_MAX_BITS; bits++) {
+        code = (code + bl_count[bits-1]) << 1;
+        next_code[bits] = code;
+    }
+
+    for (int n = 0; n < num_symbols; n++) {
+        uint8_t len = code_lengths[n];
+        if (len != 0) {
+            codes[n] = next_code[len];
+            next_code[len]++;
+        } else {
+            codes[n] = 0;
+        }
+    }
+}
+
+// how many codes of the longest length could still be added to the code, or
+// -1 if it is over-subscribed, that is if more codes of some length are asked
+// for than there are left over from the shorter lengths
+static int codes_left(const uint8_t *code_lengths, int num_symbols) {
+    int bl_count[HUFFMAN_MAX_BITS + 1] = {0};
+    for (int i = 0; i < num_symbols; i++) {
+        bl_count[code_lengths[i]]++;
+    }
+    int left = 1;
+    for (int bits = 1; bits <= HUFFMAN_MAX_BITS; bits++) {
+        left = (left << 1) - bl_count[bits];
+        if (left < 0) {
+            return -1;
+        }
+    }
+    return left;
+}
+
+bool huffman_code_complete(const uint8_t *code_lengths, int num_symbols) {
+    return codes_left(code_lengths, num_symbols) == 0;
+}
+
+static int compare_keys(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+void huffman_code_lengths(const uint32_t *frequencies, int num_symbols, int max_bits, uint8_t *code_lengths) {
+    // the symbols in use, least frequent first; each key is a frequency with
+    // the symbol in its low bits
+    uint64_t keys[HUFFMAN_MAX_SYMBOLS];
+    int used = 0;
+    for (int n = 0; n < num_symbols; n++) {
+        code_lengths[n] = 0;
+        if (frequencies[n] > 0) {
+            keys[used++] = ((uint64_t)frequencies[n] << 16) | (uint64_t)n;
+        }
+    }
+    if (used < 2) {
+        for (int n = 0; used < 2 && n < num_symbols; n++) {
+            if (frequencies[n] == 0) {
+                keys[used++] = (uint64_t)n;
+            }
+        }
+        for (int i = 0; i < used; i++) {
+            code_lengths[keys[i] & 0xFFFF] = 1;
+        }
+        return;
+    }
+    qsort(keys, used, sizeof(uint64_t), compare_keys);
+
+    // Build the tree with two queues: the leaves in order, then the internal
+    // nodes, which are made in order of weight, so the two lightest nodes are
+    // always at the front of one queue or the other. Nodes are numbered leaves
+    // first, so a parent always has a higher number than its children.
+    uint64_t weights[2 * HUFFMAN_MAX_SYMBOLS];
+    int parents[2 * HUFFMAN_MAX_SYMBOLS];
+    int depths[2 * HUFFMAN_MAX_SYMBOLS];
+    for (int i = 0; i < used; i++) {
+        weights[i] = keys[i] >> 16;
+    }
+    int next_leaf = 0;
+    int next_internal = used;
+    for (int node = used; node < 2 * used - 1; node++) {
+        weights[node] = 0;
+        for (int child = 0; child < 2; child++) {
+            int lightest;
+            if (next_leaf < used && (next_internal == node || weights[next_leaf] <= weights[next_internal])) {
+                lightest = next_leaf++;
+            } else {
+                lightest = next_internal++;
+            }
+            weights[node] += weights[lightest];
+            parents[lightest] = node;
+        }
+    }
+    int root = 2 * used - 2;
+    depths[root] = 0;
+    for (int node = root - 1; node >= 0; node--) {
+        depths[node] = depths[parents[node]] + 1;
+    }
+
+    // Codes that came out too long are cut down to max_bits, which leaves the
+    // code over-subscribed. kraft counts the slots the codes take up out of
+    // the 2^max_bits there are. Moving a shorter code down a level and letting
+    // one of the longest codes share its old slot frees up one slot at a time
+    // until they all fit, as zlib does.
+    int bl_count[HUFFMAN_MAX_BITS + 1] = {0};
+    for (int i = 0; i < used; i++) {
+        bl_count[(depths[i] < max_bits) ? depths[i] : max_bits]++;
+    }
+    uint32_t kraft = 0;
+    for (int bits = 1; bits <= max_bits; bits++) {
+        kraft += (uint32_t)bl_count[bits] << (max_bits - bits);
+    }
+    while (kraft > (1u << max_bits)) {
+        int bits = max_bits - 1;
+        while (bl_count[bits] == 0) {
+            bits--;
+        }
+        bl_count[bits]--;
+        bl_count[bits + 1] += 2;
+        bl_count[max_bits]--;
+        kraft--;
+    }
+
+    // the least frequent symbols get the longest codes
+    int i = 0;
+    for (int bits = max_bits; bits >= 1; bits--) {
+        for (int count = bl_count[bits]; count > 0; count--) {
+            code_lengths[keys[i++] & 0xFFFF] = (uint8_t)bits;
+        }
+    }
+}
+
+bool huffman_arena_init(huffman_arena *arena, size_t size) {
+    arena->entries = malloc(size * sizeof(huffman_entry));
+    arena->size = (arena->entries != NULL) ? size : 0;
+    arena->used = 0;
+    return arena->entries != NULL;
+}
+
+void huffman_arena_reset(huffman_arena *arena) {
+    arena->used = 0;
+}
+
+void huffman_arena_free(huffman_arena *arena) {
+    free(arena->entries);
+    arena->entries = NULL;
+    arena->size = 0;
+    arena->used = 0;
+}
+
+bool huffman_table_build(huffman_table *table, huffman_arena *arena, const uint8_t *code_lengths, int num_symbols, int root_bits,
+                         const huffman_value *values) {
+    if (num_symbols > HUFFMAN_MAX_SYMBOLS || codes_left(code_lengths, num_symbols) < 0) {
+        return false;
+    }
+
+    if (root_bits > MAX_ROOT_BITS) {
+        root_bits = MAX_ROOT_BITS;
+    }
+    uint16_t codes[HUFFMAN_MAX_SYMBOLS];
+    huffman_canonical_codes(code_lengths, num_symbols, codes);
+
+    // codes longer than root_bits are grouped by their first root_bits bits;
+    // each group gets a sub-table wide enough for its longest code
+    size_t root_size = (size_t)1 << root_bits;
+    uint8_t sub_bits[1 << MAX_ROOT_BITS] = {0};
+    for (int n = 0; n < num_symbols; n++) {
+        int len = code_lengths[n];
+        if (len > root_bits) {
+            uint16_t index = reverse_bits(codes[n], len) & (root_size - 1);
+            if (len - root_bits > sub_bits[index]) {
+                sub_bits[index] = (uint8_t)(len - root_bits);
+            }
+        }
+    }
+    size_t size = root_size;
+    for (size_t i = 0; i < root_size; i++) {
+        if (sub_bits[i] != 0) {
+            size += (size_t)1 << sub_bits[i];
+        }
+    }
+
+    if (size > arena->size - arena->used) {
+        return false;
+    }
+    table->entries = arena->entries + arena->used;
+    arena->used += size;
+    memset(table->entries, 0, size * sizeof(huffman_entry));
+    table->root_bits = root_bits;
+    table->size = size;
+
+    // lay out the links to sub-tables after the primary table
+    size_t next_sub_table = root_size;
+    for (size_t i = 0; i < root_size; i++) {
+        if (sub_bits[i] != 0) {
+            table->entries[i].value = (uint16_t)next_sub_table;
+            table->entries[i].bits = (uint8_t)root_bits;
+            table->entries[i].extra = HUFFMAN_LINK | sub_bits[i];
+            next_sub_table += (size_t)1 << sub_bits[i];
+        }
+    }
+
+    // a code of length len occupies every slot whose low len bits match it
+    for (int n = 0; n < num_symbols; n++) {
+        int len = code_lengths[n];
+        if (len == 0) {
+            continue;
+        }
+        uint16_t reversed = reverse_bits(codes[n], len);
+        huffman_value value = (values != NULL) ? values[n] : (huffman_value){(uint16_t)n, 0};
+        huffman_entry entry = {value.base, (uint8_t)len, value.extra_bits};
+        if (len + value.extra_bits <= root_bits) {
+            // the extra bits come right after the code, so they pick out one
+            // of the slots the code would otherwise fill
+            int width = len + value.extra_bits;
+            for (uint16_t extra = 0; extra < (1u << value.extra_bits); extra++) {
+                huffman_entry folded = {(uint16_t)(value.base + extra), (uint8_t)width, 0};
+                for (size_t i = reversed | ((size_t)extra << len); i < root_size; i += (size_t)1 << width) {
+                    table->entries[i] = folded;
+                }
+            }
+        } else if (len <= root_bits) {
+            for (size_t i = reversed; i < root_size; i += (size_t)1 << len) {
+                table->entries[i] = entry;
+            }
+        } else {
+            huffman_entry link = table->entries[reversed & (root_size - 1)];
+            size_t sub_size = (size_t)1 << (link.extra & ~HUFFMAN_LINK);
+            entry.bits = (uint8_t)(len - root_bits);
+            for (size_t i = reversed >> root_bits; i < sub_size; i += (size_t)1 << entry.bits) {
+                table->entries[link.value + i] = entry;
+            }
+        }
+    }
+
+    return true;
+}
+
+// does *entry* stand for a literal?
+static bool is_literal(huffman_entry entry) {
+    return entry.bits != 0 && entry.extra == 0 && entry.value < 256;
+}
+
+void huffman_table_pair_literals(huffman_table *table) {
+    size_t root_size = (size_t)1 << table->root_bits;
+    // the second code starts right after the first, so the slot for it is the
+    // index shifted down past the first, which is never a higher slot;
+    // going from the top down, that slot hasn't been paired up yet
+    for (size_t i = root_size; i-- > 0;) {
+        huffman_entry first = table->entries[i];
+        if (!is_literal(first)) {
+            continue;
+        }
+        huffman_entry second = table->entries[i >> first.bits];
+        if (is_literal(second) && first.bits + second.bits <= table->root_bits) {
+            huffman_entry pair = {(uint16_t)(first.value | (second.value << 8)), (uint8_t)(first.bits + second.bits),
+                                  (uint8_t)(HUFFMAN_LITERALS | HUFFMAN_PAIR | first.bits)};
+            table->entries[i] = pair;
+        } else {
+            table->entries[i].extra = (uint8_t)(HUFFMAN_LITERALS | first.bits);
+        }
+    }
+}
@@ -0,0 +1,153 @@
+//
+//  huffman.h
+//  nflate
+//
+//  Copyright (c) 2020 David Kopec
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#ifndef huffman_h
+#define huffman_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "bitstream.h"
+
+// Based on RFC 1951 section 3.2.2
+// https://tools.ietf.org/html/rfc1951
+
+#define HUFFMAN_MAX_BITS 15
+#define HUFFMAN_INVALID_SYMBOL 65535
+#define HUFFMAN_MAX_SYMBOLS 288 // the literal/length alphabet is the largest
+
+// One slot of a decode table. In the primary table a code of *bits* <= root_bits
+// fills every slot whose low *bits* bits equal the (reversed) code. Longer codes
+// share a slot that links to a sub-table indexed by the bits after the first
+// root_bits; such a link has HUFFMAN_LINK set in *extra* along with the width
+// of the sub-table, and *value* holds the offset of the sub-table within entries.
+// When a code is followed by extra bits that fit in the primary table along
+// with it, they are folded into the slots as well: each slot holds the final
+// value for one setting of the extra bits, and *bits* covers both.
+// After huffman_table_pair_literals(), primary slots for literals have
+// HUFFMAN_LITERALS set in *extra* along with the length of the first code,
+// and a slot whose bits hold two whole literal codes holds both: HUFFMAN_PAIR
+// is set as well, *value* holds the first literal in its low byte and the
+// second in its high byte, and *bits* covers both codes.
+typedef struct {
+    uint16_t value; // decoded value, or sub-table offset for links
+    uint8_t bits; // bits to consume, 0 if no code maps to this slot
+    uint8_t extra; // extra bits to read and add to value, or HUFFMAN_LINK plus the sub-table width
+} huffman_entry;
+
+#define HUFFMAN_LINK 0x80
+#define HUFFMAN_LITERALS 0x40
+#define HUFFMAN_PAIR 0x20
+#define HUFFMAN_FIRST_BITS 0x0F // length of the first code in a slot with HUFFMAN_LITERALS
+
+// what a symbol decodes to: *base* plus the value of the *extra_bits* bits
+// that follow its code
+typedef struct {
+    uint16_t base;
+    uint8_t extra_bits;
+} huffman_value;
+
+typedef struct {
+    huffman_entry *entries;
+    int root_bits;
+    size_t size;
+} huffman_table;
+
+// Fill *codes* with the canonical Huffman code of every symbol given its code length
+// code lengths of 0 mean the symbol is unused and get a code of 0
+void huffman_canonical_codes(const uint8_t *code_lengths, int num_symbols, uint16_t *codes);
+
+// true if the code lengths use up every code, with none left unassigned
+bool huffman_code_complete(const uint8_t *code_lengths, int num_symbols);
+
+// Fill *code_lengths* with the lengths of a Huffman code for symbols that
+// occur *frequencies* times, none longer than *max_bits*, for compressing
+// Unused symbols get a length of 0. The code is always complete, so if fewer
+// than two symbols are used, unused ones are given codes to make up two.
+void huffman_code_lengths(const uint32_t *frequencies, int num_symbols, int max_bits, uint8_t *code_lengths);
+
+// Storage for the decode tables of a block, set up once per decompression and
+// reset at the start of every block, so building tables needs no heap calls
+typedef struct {
+    huffman_entry *entries;
+    size_t size;
+    size_t used;
+} huffman_arena;
+
+// the most entries a table for codes of up to *max_bits* bits can need: the
+// primary table plus, at worst, a sub-table as wide as the longest code allows
+// for every symbol
+#define HUFFMAN_MAX_ENTRIES(num_symbols, root_bits, max_bits) \
+    (((size_t)1 << (root_bits)) + ((size_t)(num_symbols) << ((max_bits) - (root_bits))))
+
+// returns false if out of memory
+bool huffman_arena_init(huffman_arena *arena, size_t size);
+// make all of the arena available again; tables built from it are no longer valid
+void huffman_arena_reset(huffman_arena *arena);
+void huffman_arena_free(huffman_arena *arena);
+
+// Build a decode table in *table*, taking its entries from *arena*, with a
+// primary table of *root_bits* bits for the code described by *code_lengths*
+// *values* gives what each symbol decodes to, or is NULL for symbols that
+// decode to themselves with no extra bits
+// Returns false if the code lengths are over-subscribed or the arena is full
+bool huffman_table_build(huffman_table *table, huffman_arena *arena, const uint8_t *code_lengths, int num_symbols, int root_bits,
+                         const huffman_value *values);
+
+// Mark the slots of the primary table of *table* for symbols that decode to
+// values below 256 with no extra bits, literals, and let them decode two at
+// once where both codes fit
+void huffman_table_pair_literals(huffman_table *table);
+
+// The primary table entry for the next bits of *bs*, which may be a pair of
+// literals; at least root_bits bits must be buffered
+static inline huffman_entry huffman_root_entry(bitstream *bs, const huffman_table *table) {
+    return table->entries[bs_peek_bits_rev(bs, table->root_bits)];
+}
+
+// Decode one symbol from *bs* using *table*, along with any extra bits after it,
+// given *entry*, the primary table entry for the next bits (see huffman_root_entry)
+// At least HUFFMAN_MAX_BITS bits plus the symbol's extra bits must be
+// buffered (see bs_refill)
+// Returns the value of the symbol, or HUFFMAN_INVALID_SYMBOL if the bits don't match any code
+static inline uint16_t huffman_decode_entry(bitstream *bs, const huffman_table *table, huffman_entry entry) {
+    if (entry.extra & HUFFMAN_LINK) {
+        uint32_t peek = bs_peek_bits_rev(bs, HUFFMAN_MAX_BITS) >> table->root_bits;
+        bs_consume_bits(bs, table->root_bits);
+        entry = table->entries[entry.value + (peek & ((1u << (entry.extra & ~HUFFMAN_LINK)) - 1))];
+    } else if (entry.extra & HUFFMAN_LITERALS) {
+        // just the first of a pair
+        bs_consume_bits(bs, entry.extra & HUFFMAN_FIRST_BITS);
+        return entry.value & 0xFF;
+    }
+    if (entry.bits == 0) {
+        return HUFFMAN_INVALID_SYMBOL;
+    }
+    bs_consume_bits(bs, entry.bits);
+    return (uint16_t)(entry.value + bs_pop_bits_rev(bs, entry.extra));
+}
+
+// Decode one symbol from *bs* using *table*, along with any extra bits after it
+// At least HUFFMAN_MAX_BITS bits plus the symbol's extra bits must be
+// buffered (see bs_refill)
+// Returns the value of the symbol, or HUFFMAN_INVALID_SYMBOL if the bits don't match any code
+static inline uint16_t huffman_decode(bitstream *bs, const huffman_table *table) {
+    return huffman_decode_entry(bs, table, huffman_root_entry(bs, table));
+}
+
+#endif /* huffman_h */
@@ -21,81 +21,495 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
 #include "gzipfile.h"
+#include "members.h"
+#include "gzindex.h"
+#include "writer.h"
+#include "thread.h"
+#include "deflate.h"
+#include "zlibfile.h"
+#include "zipfile.h"
+#include "bgzf.h"
 #include "nflate.h"
-#include "crc32.h"
 
-static bool has_gz_suffix(const char *str) {
+// length of the extension of *str* if it is one compressed files have, or 0
+static size_t compressed_suffix_length(const char *str) {
+    static const char *suffixes[] = {".gz", ".zz", ".zlib", ".deflate"};
     char *ending = strrchr(str, '.');
-    if (ending == NULL) { return false; }
-    return !strcmp(ending, ".gz");
+    if (ending == NULL) { return 0; }
+    for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++) {
+        if (!strcmp(ending, suffixes[i])) {
+            return strlen(ending);
+        }
+    }
+    return 0;
+}
+
+// hand output to the writer as soon as it's decoded
+static bool write_output(const uint8_t *data, size_t length, void *context) {
+    return writer_write(context, data, length);
+}
+
+// the index of *name* lives next to it in *name*.idx
+static char *index_file_name(const char *name) {
+    size_t name_length = strlen(name);
+    char *index_name = malloc(name_length + 5);
+    if (index_name != NULL) {
+        memcpy(index_name, name, name_length);
+        memcpy(index_name + name_length, ".idx", 5);
+    }
+    return index_name;
+}
+
+// build an index of *gzf* and save it next to the file *name*
+static int write_index(gzipfile *gzf, const char *name) {
+    char *index_name = index_file_name(name);
+    gzindex *index = (index_name != NULL) ? gzindex_build(gzf, GZINDEX_DEFAULT_SPAN) : NULL;
+    bool written = (index != NULL) && gzindex_write(index, index_name);
+    if (index == NULL) {
+        fprintf(stderr, "Couldn't index data.\n");
+    }
+    gzindex_free(index);
+    free(index_name);
+    return written ? 0 : 1;
+}
+
+// inflate just *length* bytes starting *offset* bytes into the data of the
+// file *name*, starting from its index if it has one
+static bool extract_range(gzipfile *gzf, const char *name, uint64_t offset, size_t length, writer *out_file) {
+    char *index_name = index_file_name(name);
+    gzindex *index = (index_name != NULL) ? gzindex_read(index_name) : NULL;
+    free(index_name);
+    uint8_t *range = malloc((length > 0) ? length : 1);
+    if (range == NULL) {
+        fprintf(stderr, "Error allocating memory for output.\n");
+        gzindex_free(index);
+        return false;
+    }
+    size_t copied = 0;
+    bool extracted = gzindex_extract(gzf, index, offset, range, length, &copied) && write_output(range, copied, out_file);
+    free(range);
+    gzindex_free(index);
+    return extracted;
+}
+
+// inflate the zlib stream or raw DEFLATE data *file* holds, depending on
+// *container*, using the file *dictionary_name* as the preset dictionary if it isn't NULL
+static bool inflate_single(gzipfile *file, container_type container, const char *dictionary_name, writer *out_file) {
+    gzipfile *dictionary = NULL;
+    if (dictionary_name != NULL) {
+        dictionary = read_plain_file(dictionary_name);
+        if (dictionary == NULL) {
+            fprintf(stderr, "Couldn't read dictionary.\n");
+            return false;
+        }
+    }
+    const uint8_t *dictionary_data = (dictionary != NULL) ? dictionary->data : NULL;
+    size_t dictionary_length = (dictionary != NULL) ? dictionary->data_length : 0;
+    size_t length = 0;
+    uint8_t *result;
+    if (container == CONTAINER_ZLIB) {
+        result = inflate_zlib(file->data, file->data_length, dictionary_data, dictionary_length, &length, NULL);
+    } else {
+        result = nflate_with_dictionary(file->data, file->data_length, dictionary_data, dictionary_length, 0, &length, NULL);
+    }
+    bool written = (result != NULL) && write_output(result, length, out_file);
+    free(result);
+    if (dictionary != NULL) {
+        free_gzfipfile(dictionary);
+    }
+    return written;
+}
+
+// inflate the BGZF file *gzf* with the blocks in *index*, all of them on
+// *num_threads* threads, or with *range* just *length* bytes from the
+// *offset*th byte of its data, or from the virtual offset *offset* if
+// *virtual_offset* is set too
+static bool inflate_bgzf(gzipfile *gzf, const bgzf_index *index, int num_threads, bool range, bool virtual_offset,
+                         uint64_t offset, size_t length, writer *out_file) {
+    bool inflated;
+    if (!range) {
+        inflated = bgzf_inflate(gzf, index, num_threads, write_output, out_file);
+    } else {
+        uint8_t *piece = malloc((length > 0) ? length : 1);
+        size_t copied = 0;
+        // a range past the end of the data is empty
+        bool past_end = !virtual_offset && !bgzf_virtual_offset(index, offset, &offset);
+        inflated = (piece != NULL) && (past_end || bgzf_read(gzf, index, offset, piece, length, &copied)) &&
+                   write_output(piece, copied, out_file);
+        free(piece);
+    }
+    return inflated;
+}
+
+// the name of the file *path* without the directories it is in
+static const char *base_name(const char *path) {
+    const char *name = path;
+    for (const char *c = path; *c != '\0'; c++) {
+        if (*c == '/' || *c == '\\') {
+            name = c + 1;
+        }
+    }
+    return name;
+}
+
+// compress the file *in_name*, or standard input if it is NULL, at *level* on
+// *num_threads* threads into a gzip file *out_name*, or standard output if it is NULL
+static int compress_file(const char *in_name, const char *out_name, int level, int num_threads, int writer_flags) {
+    gzipfile *plain = read_plain_file(in_name);
+    if (plain == NULL) {
+        fprintf(stderr, "Couldn't read file to compress.\n");
+        return 1;
+    }
+    size_t member_length = 0;
+    const char *FNAME = (in_name != NULL) ? base_name(in_name) : NULL;
+    uint8_t *member = deflate_gzip_parallel(plain->data, plain->data_length, level, FNAME, num_threads, &member_length);
+    free_gzfipfile(plain);
+    if (member == NULL) {
+        return 1;
+    }
+    writer *out_file = writer_open(out_name, writer_flags);
+    bool written = (out_file != NULL) && write_output(member, member_length, out_file);
+    if (out_file != NULL && !writer_close(out_file)) {
+        written = false;
+    }
+    free(member);
+    if (!written) {
+        fprintf(stderr, "Couldn't write compressed data.\n");
+        if (out_file != NULL && out_name != NULL) {
+            remove(out_name);
+        }
+    }
+    return written ? 0 : 1;
+}
+
+#ifdef NFLATE_STATS
+// print a histogram of powers of two, skipping the empty buckets
+static void print_histogram(const char *name, const uint64_t *buckets, int count, uint64_t total) {
+    fprintf(stderr, "%s:\n", name);
+    for (int i = 0; i < count; i++) {
+        if (buckets[i] > 0) {
+            fprintf(stderr, "  %6lu-%-6lu %12llu %5.1f%%\n", 1ul << i, (2ul << i) - 1, (unsigned long long)buckets[i],
+                    100.0 * buckets[i] / total);
+        }
+    }
+}
+
+// where the time went, for builds with statistics
+static void print_stats(void) {
+    nflate_stats stats;
+    nflate_stats_get(&stats);
+    uint64_t symbols = stats.literals + stats.matches + stats.blocks[1] + stats.blocks[2];
+    uint64_t matches = (stats.matches > 0) ? stats.matches : 1;
+    fprintf(stderr, "blocks: %llu stored, %llu fixed, %llu dynamic\n", (unsigned long long)stats.blocks[0],
+            (unsigned long long)stats.blocks[1], (unsigned long long)stats.blocks[2]);
+    fprintf(stderr, "symbols: %llu, %llu literals and %llu matches (%.1f%% literals)\n", (unsigned long long)symbols,
+            (unsigned long long)stats.literals, (unsigned long long)stats.matches,
+            (symbols > 0) ? 100.0 * stats.literals / symbols : 0.0);
+    fprintf(stderr, "bytes: %llu from literals, %llu from matches (%.1f per match), %llu from stored blocks\n",
+            (unsigned long long)stats.literals, (unsigned long long)stats.match_bytes, (double)stats.match_bytes / matches,
+            (unsigned long long)stats.stored_bytes);
+    print_histogram("match lengths", stats.length_histogram, NFLATE_STATS_LENGTH_BUCKETS, matches);
+    print_histogram("match distances", stats.distance_histogram, NFLATE_STATS_DISTANCE_BUCKETS, matches);
+    fprintf(stderr, "seconds: %.6f block headers, %.6f tables, %.6f Huffman symbols, %.6f stored blocks, %.6f CRC-32\n",
+            stats.header_seconds, stats.table_seconds, stats.huffman_seconds, stats.stored_seconds, stats.crc_seconds);
+}
+#endif
+
+// decompress standard input to standard output, as it arrives if it is gzip data
+static int inflate_pipe(int writer_flags, const char *dictionary_name) {
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+#endif
+    writer *out_file = writer_open(NULL, writer_flags);
+    if (out_file == NULL) {
+        return 1;
+    }
+    // the first byte is enough to tell gzip data apart, as a zlib header can't start with it
+    int first = getc(stdin);
+    if (first != EOF) {
+        ungetc(first, stdin);
+    }
+    bool inflated;
+    if (first == 0x1F) {
+        inflated = inflate_members_from_file(stdin, write_output, out_file);
+    } else {
+        // zlib streams and raw DEFLATE data are read in full first
+        gzipfile *input = read_plain_file(NULL);
+        inflated = (input != NULL) &&
+                   inflate_single(input, detect_container(input->data, input->data_length), dictionary_name, out_file);
+        if (input != NULL) {
+            free_gzfipfile(input);
+        }
+    }
+    if (!writer_close(out_file)) {
+        inflated = false;
+    }
+    if (!inflated) {
+        fprintf(stderr, "Couldn't inflate data.\n");
+    }
+#ifdef NFLATE_STATS
+    print_stats();
+#endif
+    return inflated ? 0 : 1;
+}
+
+// write the contents of every entry of *zip* to standard output, one after another
+static bool write_zip_entries(const zipfile *zip, int writer_flags) {
+    writer *out_file = writer_open(NULL, writer_flags);
+    nflate_context *context = nflate_context_create();
+    bool written = (out_file != NULL) && (context != NULL);
+    for (size_t i = 0; written && i < zip->num_entries; i++) {
+        const zip_entry *entry = &zip->entries[i];
+        if (entry->uncompressed_size > (size_t)-1) {
+            written = false;
+            break;
+        }
+        uint8_t *contents = malloc((entry->uncompressed_size > 0) ? (size_t)entry->uncompressed_size : 1);
+        written = (contents != NULL) && zip_extract_entry(zip, entry, context, contents) &&
+                  write_output(contents, (size_t)entry->uncompressed_size, out_file);
+        if (!written) {
+            fprintf(stderr, "Couldn't extract %s.\n", entry->name);
+        }
+        free(contents);
+    }
+    nflate_context_free(context);
+    if (out_file != NULL && !writer_close(out_file)) {
+        written = false;
+    }
+    return written;
+}
+
+// extract the ZIP archive in *file* into *directory*, or to standard output
+static int extract_zip(gzipfile *file, const char *directory, bool to_stdout, int num_threads, int writer_flags) {
+    zipfile *zip = zip_open(file);
+    if (zip == NULL) {
+        fprintf(stderr, "Couldn't read ZIP archive.\n");
+        return 1;
+    }
+    bool extracted = to_stdout ? write_zip_entries(zip, writer_flags) : zip_extract_all(zip, directory, num_threads);
+    free_zipfile(zip);
+    if (!extracted) {
+        fprintf(stderr, "Couldn't extract every entry.\n");
+    }
+#ifdef NFLATE_STATS
+    print_stats();
+#endif
+    return extracted ? 0 : 1;
 }
 
 int main(int argc, const char * argv[]) {
+    // -p threads inflates the members of a multi-member file in parallel
+    int num_threads = 1;
+    // -i writes an index for random access next to the file instead of decompressing it
+    bool build_index = false;
+    // -r offset length decompresses only that range, using the index if there is one
+    bool range = false;
+    uint64_t range_offset = 0;
+    size_t range_length = 0;
+    // -b virtual_offset length does the same for BGZF files, from a virtual offset
+    bool virtual_range = false;
+    // -d writes the output with O_DIRECT, bypassing the page cache
+    int writer_flags = (thread_cpu_count() > 1) ? WRITER_BACKGROUND : 0;
+    // -c writes to standard output; with no file name, or -, input comes from standard input
+    bool to_stdout = false;
+    // -z compresses instead, at the level given by -0 (no compression) to -9
+    bool compress = false;
+    int level = DEFLATE_DEFAULT_LEVEL;
+    // -D file gives the preset dictionary for zlib or raw DEFLATE data
+    const char *dictionary_name = NULL;
+    while (argc > 1 && argv[1][0] == '-') {
+        if (!strcmp(argv[1], "-p") && argc > 2) {
+            num_threads = atoi(argv[2]);
+            if (num_threads < 1) {
+                num_threads = thread_cpu_count();
+            }
+            argc -= 2;
+            argv += 2;
+        } else if (!strcmp(argv[1], "-c")) {
+            to_stdout = true;
+            argc -= 1;
+            argv += 1;
+        } else if (!strcmp(argv[1], "-d")) {
+            writer_flags |= WRITER_DIRECT;
+            argc -= 1;
+            argv += 1;
+        } else if (!strcmp(argv[1], "-D") && argc > 2) {
+            dictionary_name = argv[2];
+            argc -= 2;
+            argv += 2;
+        } else if (!strcmp(argv[1], "-z")) {
+            compress = true;
+            argc -= 1;
+            argv += 1;
+        } else if (argv[1][1] >= '0' && argv[1][1] <= '9' && argv[1][2] == '\0') {
+            level = argv[1][1] - '0';
+            argc -= 1;
+            argv += 1;
+        } else if (!strcmp(argv[1], "-i")) {
+            build_index = true;
+            argc -= 1;
+            argv += 1;
+        } else if (!strcmp(argv[1], "-r") && argc > 3) {
+            range = true;
+            range_offset = strtoull(argv[2], NULL, 10);
+            range_length = (size_t)strtoull(argv[3], NULL, 10);
+            argc -= 3;
+            argv += 3;
+        } else if (!strcmp(argv[1], "-b") && argc > 3) {
+            range = true;
+            virtual_range = true;
+            range_offset = strtoull(argv[2], NULL, 10);
+            range_length = (size_t)strtoull(argv[3], NULL, 10);
+            argc -= 3;
+            argv += 3;
+        } else {
+            break;
+        }
+    }
+    if (compress && (argc > 1 || to_stdout)) {
+        bool from_stdin = (argc < 2 || !strcmp(argv[1], "-"));
+        if (from_stdin && !to_stdout) {
+            fprintf(stderr, "Compressing standard input needs -c.\n");
+            return 1;
+        }
+        const char *in_name = from_stdin ? NULL : argv[1];
+        if (to_stdout) {
+            return compress_file(in_name, NULL, level, num_threads, writer_flags);
+        }
+        if (argc > 2) {
+            return compress_file(in_name, argv[2], level, num_threads, writer_flags);
+        }
+        // otherwise add .gz to the name
+        size_t name_length = strlen(in_name);
+        char *out_file_name = malloc(name_length + 4);
+        if (out_file_name == NULL) {
+            return 1;
+        }
+        memcpy(out_file_name, in_name, name_length);
+        memcpy(out_file_name + name_length, ".gz", 4);
+        int result = compress_file(in_name, out_file_name, level, num_threads, writer_flags);
+        free(out_file_name);
+        return result;
+    }
+    if (to_stdout && (argc < 2 || !strcmp(argv[1], "-"))) {
+        if (build_index || range) {
+            fprintf(stderr, "-i and -r need a file to seek in.\n");
+            return 1;
+        }
+        return inflate_pipe(writer_flags, dictionary_name);
+    }
     if (argc < 2) {
         fprintf(stderr, "Need a filename.\n");
-        printf("Usage: nflate file_to_be_decompressed.gz [out_file_name]\n");
+        printf("Usage: nflate [-c] [-p threads] [-d] [-i] [-r offset length] [-b virtual_offset length] [-D dictionary] file_to_be_decompressed.gz [out_file_name]\n");
+        printf("       nflate -z [-0 to -9] [-c] [-p threads] [-d] file_to_be_compressed [out_file_name]\n");
         return 1;
     }
-    gzipfile *gzf = read_gzipfile(argv[1]);
+    gzipfile *gzf = read_plain_file(argv[1]);
     if (gzf == NULL) {
-        fprintf(stderr, "Cound't read gzip file.\n");
+        fprintf(stderr, "Couldn't read compressed file.\n");
         return 1;
     }
-    
-    size_t uncompressed_length = 0;
-    uint8_t *uncompressed = nflate(gzf->data, gzf->data_length, &uncompressed_length);
-    //printf("%s", uncompressed);
-
-    // CRC is on uncompressed data
-    if (!doCRC32Check(uncompressed, uncompressed_length, gzf->CRC32)) {
-        fprintf(stderr, "CRC32 check did not pass on data.\n");
+    if (zip_detect(gzf->contents, gzf->contents_length)) {
+        if (build_index || range) {
+            fprintf(stderr, "-i and -r only work on gzip files.\n");
+            free_gzfipfile(gzf);
+            return 1;
+        }
+        // entries go in the directory given, or the current one
+        return extract_zip(gzf, (argc > 2) ? argv[2] : ".", to_stdout, num_threads, writer_flags);
+    }
+    container_type container = detect_container(gzf->contents, gzf->contents_length);
+    if (container == CONTAINER_GZIP && !gzip_parse_file(gzf)) {
+        fprintf(stderr, "Couldn't read gzip header.\n");
+        free_gzfipfile(gzf);
+        return 1;
+    }
+    if (container != CONTAINER_GZIP && (build_index || range)) {
+        fprintf(stderr, "-i and -r only work on gzip files.\n");
+        free_gzfipfile(gzf);
+        return 1;
+    }
+    if (build_index) {
+        int result = write_index(gzf, argv[1]);
+        free_gzfipfile(gzf);
+        return result;
+    }
+    // a file that only starts out as BGZF is inflated member by member like any other
+    bgzf_index *blocks = (container == CONTAINER_GZIP && bgzf_detect(gzf)) ? bgzf_index_blocks(gzf) : NULL;
+    if (virtual_range && blocks == NULL) {
+        fprintf(stderr, "-b only works on BGZF files.\n");
+        free_gzfipfile(gzf);
+        return 1;
     }
     
     // write output file
-    FILE *out_file;
+    writer *out_file;
     // figure out file name
     char *out_file_name = NULL;
-    if (argc > 2) { // if one is specified use it
-        size_t name_length = strlen(argv[2]);
-        out_file_name = malloc(name_length + 1);
-        strncpy(out_file_name, argv[2], name_length + 1);
-    } else {
-        if (gzf->header.FLG.FNAME) { // if gzipped file specifies out file name
-            size_t name_length = strlen(gzf->FNAME);
+    if (!to_stdout) { // standard output needs no name
+        if (argc > 2) { // if one is specified use it
+            size_t name_length = strlen(argv[2]);
             out_file_name = malloc(name_length + 1);
-            strncpy(out_file_name, gzf->FNAME, name_length + 1);
-            //printf("%s", out_file_name);
+            strncpy(out_file_name, argv[2], name_length + 1);
         } else {
-            // if the file ends in .gz, just remove the extension
-            if (has_gz_suffix(argv[1])) {
-                size_t name_length = strlen(argv[1]) - 3;
+            if (container == CONTAINER_GZIP && gzf->header.FLG.FNAME) { // if gzipped file specifies out file name
+                size_t name_length = strlen(gzf->FNAME);
                 out_file_name = malloc(name_length + 1);
-                strncpy(out_file_name, argv[1], name_length);
-                out_file_name[name_length] = '\0';
-            } else { // otherwise use default "result" name
-                out_file_name = malloc(6);
-                strncpy(out_file_name, "hello", 6);
+                strncpy(out_file_name, gzf->FNAME, name_length + 1);
+                //printf("%s", out_file_name);
+            } else {
+                // if the file ends in .gz or the like, just remove the extension
+                size_t suffix_length = compressed_suffix_length(argv[1]);
+                if (suffix_length > 0) {
+                    size_t name_length = strlen(argv[1]) - suffix_length;
+                    out_file_name = malloc(name_length + 1);
+                    strncpy(out_file_name, argv[1], name_length);
+                    out_file_name[name_length] = '\0';
+                } else { // otherwise use default "result" name
+                    out_file_name = malloc(6);
+                    strncpy(out_file_name, "hello", 6);
+                }
             }
         }
     }
-    out_file = fopen(out_file_name, "w");
+    out_file = writer_open(out_file_name, writer_flags);
     if (out_file == NULL) {
-        perror ("The following error occurred\n");
+        free(out_file_name);
+        bgzf_index_free(blocks);
+        free_gzfipfile(gzf);
+        return 1;
     }
-    size_t written_bytes = fwrite(uncompressed, 1, uncompressed_length, out_file);
-    if (written_bytes != uncompressed_length) {
-        printf("Expected to write %zu bytes, but fwrite returned %zu.\n", uncompressed_length, written_bytes);
+
+    bool inflated;
+    if (container != CONTAINER_GZIP) {
+        inflated = inflate_single(gzf, container, dictionary_name, out_file);
+    } else if (blocks != NULL) {
+        inflated = inflate_bgzf(gzf, blocks, num_threads, range, virtual_range, range_offset, range_length, out_file);
+    } else if (range) {
+        inflated = extract_range(gzf, argv[1], range_offset, range_length, out_file);
+    } else {
+        inflated = inflate_members(gzf, num_threads, write_output, out_file);
     }
-    
-    if (ferror(out_file)) {
-        perror ("Error writing to file.\n");
+    if (!writer_close(out_file)) {
+        inflated = false;
+    }
+    if (!inflated) {
+        fprintf(stderr, "Couldn't inflate data.\n");
+        if (out_file_name != NULL) {
+            remove(out_file_name); // don't leave a partial file behind
+        }
     }
-    fflush(out_file);
-    fclose(out_file);
     
+#ifdef NFLATE_STATS
+    print_stats();
+#endif
     free(out_file_name);
-    free(uncompressed);
+    bgzf_index_free(blocks);
     free_gzfipfile(gzf);
-    return 0;
+    return inflated ? 0 : 1;
 }
@@ -0,0 +1,495 @@
+//
+//  members.c
+//  nflate
+//
+//  Copyright (c) 2020 David Kopec
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "members.h"
+#include "nflate.h"
+#include "threadpool.h"
+#include "parallel.h"
+
+#define TRAILER_LENGTH 8
+#define MEMBERS_PER_THREAD 2 // how far ahead of the output the workers may run
+#define STREAM_BUFFER_SIZE 65536
+
+// The end of a member is only known once it has been inflated, so members are
+// found by inflating them in a chain. To run ahead of the chain, every offset
+// where a valid header appears is inflated on the pool as a guess. Guesses
+// inside compressed data almost always fail to inflate right away; the chain
+// only ever uses the guess at the exact offset where the previous member ended.
+typedef struct {
+    gzipfile *gzf;
+    size_t offset; // start of the member's header within the file
+    size_t size_hint; // guess at the uncompressed size, or 0
+    threadpool_task *task; // NULL if it isn't running on the pool
+
+    // filled in by inflate_member() or stream_member()
+    uint8_t *output; // NULL if this isn't a valid member or its output was streamed
+    size_t output_length;
+    uint32_t crc;
+    size_t end; // one past the end of the trailer, 0 if this isn't a valid member
+    uint32_t CRC32;
+    uint32_t ISIZE;
+} member;
+
+static void inflate_member(void *argument) {
+    member *m = argument;
+    uint8_t *start = m->gzf->contents + m->offset;
+    size_t length = m->gzf->contents_length - m->offset;
+    size_t header_length = gzip_header_length(start, length);
+    if (header_length == 0) {
+        return;
+    }
+    size_t consumed;
+    m->output = nflate_member(start + header_length, length - header_length, m->size_hint, &m->output_length, &consumed, &m->crc);
+    if (m->output == NULL) {
+        return;
+    }
+    size_t trailer = header_length + consumed;
+    if (length - trailer < TRAILER_LENGTH) {
+        free(m->output);
+        m->output = NULL;
+        return;
+    }
+    m->CRC32 = gzip_read_le32(start + trailer);
+    m->ISIZE = gzip_read_le32(start + trailer + 4);
+    m->end = m->offset + trailer + TRAILER_LENGTH;
+}
+
+// inflate the member at m->offset with the streaming interface, handing its
+// output to *write* a piece at a time instead of holding all of it; without a
+// pool this is how members are inflated, so output reaches the disk while
+// decoding is still going on
+// returns false if *write* failed
+static bool stream_member(member *m, members_writer write, void *context) {
+    gzipfile *gzf = m->gzf;
+    size_t header_length = gzip_header_length(gzf->contents + m->offset, gzf->contents_length - m->offset);
+    if (header_length == 0) {
+        return true;
+    }
+    nflate_stream *s = nflate_stream_init();
+    uint8_t *buffer = malloc(STREAM_BUFFER_SIZE);
+    if (s == NULL || buffer == NULL) {
+        fprintf(stderr, "Error allocating memory for output.\n");
+        nflate_stream_end(s);
+        free(buffer);
+        return false;
+    }
+
+    size_t position = m->offset + header_length;
+    nflate_status status;
+    bool written = true;
+    do {
+        position += nflate_stream_feed(s, gzf->contents + position, gzf->contents_length - position);
+        size_t produced;
+        do {
+            status = nflate_stream_drain(s, buffer, STREAM_BUFFER_SIZE, &produced);
+            if (produced > 0 && !write(buffer, produced, context)) {
+                written = false;
+                break;
+            }
+            m->output_length += produced;
+        } while (status == NFLATE_OK);
+    } while (written && status == NFLATE_NEEDS_INPUT && position < gzf->contents_length);
+
+    size_t trailer = position - nflate_stream_unused_input(s, NULL);
+    if (written && status == NFLATE_DONE && gzf->contents_length - trailer >= TRAILER_LENGTH) {
+        m->crc = nflate_stream_crc32(s);
+        m->CRC32 = gzip_read_le32(gzf->contents + trailer);
+        m->ISIZE = gzip_read_le32(gzf->contents + trailer + 4);
+        m->end = trailer + TRAILER_LENGTH;
+    }
+    nflate_stream_end(s);
+    free(buffer);
+    return written;
+}
+
+// inflate the member at m->offset in chunks decoded in parallel on *pool*,
+// handing its output to *write* in order; this is how a member too long for
+// a single thread to get through quickly is inflated
+// returns false if *write* failed or memory ran out
+static bool parallel_member(member *m, threadpool *pool, int max_chunks, members_writer write, void *context) {
+    gzipfile *gzf = m->gzf;
+    size_t header_length = gzip_header_length(gzf->contents + m->offset, gzf->contents_length - m->offset);
+    if (header_length == 0) {
+        return true;
+    }
+    size_t start = m->offset + header_length;
+    size_t consumed;
+    uint64_t output_length;
+    bool written = parallel_inflate(pool, max_chunks, gzf->contents + start, gzf->contents_length - start, write, context,
+                                    &consumed, &output_length, &m->crc);
+    m->output_length = (size_t)output_length;
+    size_t trailer = start + consumed;
+    if (written && consumed > 0 && gzf->contents_length - trailer >= TRAILER_LENGTH) {
+        m->CRC32 = gzip_read_le32(gzf->contents + trailer);
+        m->ISIZE = gzip_read_le32(gzf->contents + trailer + 4);
+        m->end = trailer + TRAILER_LENGTH;
+    }
+    return written;
+}
+
+static void start_member(member *m, gzipfile *gzf, size_t offset) {
+    memset(m, 0, sizeof(member));
+    m->gzf = gzf;
+    m->offset = offset;
+    // the trailer at the end of the file belongs to the first member when it's the only one
+    if (offset == 0) {
+        m->size_hint = gzf->ISIZE;
+    }
+}
+
+// wait for *m* to finish if it's running on the pool
+static void finish_member(threadpool *pool, member *m) {
+    if (m->task != NULL) {
+        threadpool_join(pool, m->task);
+        m->task = NULL;
+    }
+}
+
+// find the next offset at or after *scan* and before *limit* that starts with a plausible member header
+// returns false if there are none
+static bool next_candidate(const gzipfile *gzf, size_t *scan, size_t limit, size_t *candidate) {
+    while (*scan < limit) {
+        const uint8_t *found = memchr(gzf->contents + *scan, 31, limit - *scan);
+        if (found == NULL) {
+            break;
+        }
+        size_t offset = (size_t)(found - gzf->contents);
+        *scan = offset + 1;
+        if (gzip_header_length(found, gzf->contents_length - offset) > 0) {
+            *candidate = offset;
+            return true;
+        }
+    }
+    *scan = limit;
+    return false;
+}
+
+// is the member at *offset* long enough to be worth splitting into chunks?
+// its end isn't known until it has been inflated, so the distance to the next
+// place that looks like a member header stands in for its length
+static bool large_member(const gzipfile *gzf, size_t offset) {
+    if (gzf->contents_length - offset < PARALLEL_MIN_LENGTH) {
+        return false;
+    }
+    size_t scan = offset + 1;
+    size_t candidate;
+    return !next_candidate(gzf, &scan, offset + PARALLEL_MIN_LENGTH, &candidate);
+}
+
+static bool all_zeros(const uint8_t *data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        if (data[i] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool inflate_members(gzipfile *gzf, int num_threads, members_writer write, void *context) {
+    threadpool *pool = NULL;
+    int capacity = 1;
+    if (num_threads > 1) {
+        pool = threadpool_create(num_threads);
+        if (pool != NULL) {
+            capacity = num_threads * MEMBERS_PER_THREAD;
+        }
+    }
+    // guesses that have been handed to the pool, in file order, as a ring
+    member *queued = calloc(capacity, sizeof(member));
+    if (queued == NULL) {
+        fprintf(stderr, "Error allocating memory for members.\n");
+        threadpool_free(pool);
+        return false;
+    }
+    int first = 0;
+    int count = 0;
+
+    bool success = true;
+    size_t position = 0; // where the next member in the chain starts
+    size_t scan = 0; // where to look for the next guess
+    size_t held = SIZE_MAX; // a long member that is left to be split into chunks once the chain gets to it
+    size_t num_members = 0;
+    while (position < gzf->contents_length) {
+        // keep the pool busy with the members that may come next
+        if (scan < position) {
+            scan = position;
+        }
+        size_t candidate;
+        while (pool != NULL && count < capacity && scan != held && next_candidate(gzf, &scan, gzf->contents_length, &candidate)) {
+            if (large_member(gzf, candidate)) {
+                held = candidate;
+                scan = candidate;
+                break;
+            }
+            member *m = &queued[(first + count) % capacity];
+            start_member(m, gzf, candidate);
+            m->task = threadpool_submit(pool, inflate_member, m);
+            if (m->task == NULL) {
+                scan = candidate; // try again later
+                break;
+            }
+            count++;
+        }
+
+        // guesses that fell inside the member before were wrong
+        while (count > 0 && queued[first].offset < position) {
+            finish_member(pool, &queued[first]);
+            free(queued[first].output);
+            first = (first + 1) % capacity;
+            count--;
+        }
+
+        member current;
+        if (count > 0 && queued[first].offset == position) {
+            finish_member(pool, &queued[first]);
+            current = queued[first];
+            first = (first + 1) % capacity;
+            count--;
+        } else if (pool == NULL) {
+            start_member(&current, gzf, position);
+            if (!stream_member(&current, write, context)) {
+                success = false;
+                break;
+            }
+        } else {
+            start_member(&current, gzf, position);
+            if (large_member(gzf, position)) {
+                if (!parallel_member(&current, pool, capacity, write, context)) {
+                    success = false;
+                    break;
+                }
+            } else {
+                inflate_member(&current);
+            }
+        }
+
+        if (current.end == 0) {
+            const uint8_t *rest = gzf->contents + position;
+            size_t rest_length = gzf->contents_length - position;
+            if (num_members == 0 || gzip_header_length(rest, rest_length) > 0) {
+                fprintf(stderr, "Error inflating the member starting at byte %zu.\n", position);
+                success = false;
+            } else if (!all_zeros(rest, rest_length)) {
+                fprintf(stderr, "Ignoring %zu bytes of trailing garbage after the last member.\n", rest_length);
+            }
+            break;
+        }
+
+        // CRC is on uncompressed data
+        if (current.crc != current.CRC32) {
+            fprintf(stderr, "CRC32 check did not pass on data.\n");
+            success = false;
+        } else if ((uint32_t)current.output_length != current.ISIZE) {
+            fprintf(stderr, "ISIZE check did not pass on data.\n");
+            success = false;
+        }
+        if (!success) {
+            free(current.output);
+            break;
+        }
+        if (current.output != NULL) {
+            bool written = write(current.output, current.output_length, context);
+            free(current.output);
+            if (!written) {
+                success = false;
+                break;
+            }
+        }
+        num_members++;
+        position = current.end;
+    }
+
+    // wait for guesses that are still running
+    while (count > 0) {
+        finish_member(pool, &queued[first]);
+        free(queued[first].output);
+        first = (first + 1) % capacity;
+        count--;
+    }
+    free(queued);
+    threadpool_free(pool);
+    return success;
+}
+
+// Input read from a pipe, kept in a buffer that grows only if the stream
+// hands back more unused input than there is free space for
+typedef struct {
+    FILE *file;
+    uint8_t *data;
+    size_t capacity;
+    size_t start; // first byte not yet used
+    size_t end; // one past the last byte read
+    bool at_end; // the file has no more to give
+} pipe_input;
+
+// read more from the file, keeping the bytes not yet used
+// returns false if nothing more could be read
+static bool read_more(pipe_input *in) {
+    if (in->at_end) {
+        return false;
+    }
+    memmove(in->data, in->data + in->start, in->end - in->start);
+    in->end -= in->start;
+    in->start = 0;
+    size_t amount = fread(in->data + in->end, 1, in->capacity - in->end, in->file);
+    in->end += amount;
+    if (amount == 0) {
+        in->at_end = true;
+        if (ferror(in->file)) {
+            perror("Error reading input");
+        }
+        return false;
+    }
+    return true;
+}
+
+// put *length* bytes back in front of the bytes not yet used
+static bool unread(pipe_input *in, const uint8_t *data, size_t length) {
+    size_t kept = in->end - in->start;
+    if (kept + length > in->capacity) {
+        uint8_t *grown = realloc(in->data, kept + length);
+        if (grown == NULL) {
+            return false;
+        }
+        in->data = grown;
+        in->capacity = kept + length;
+    }
+    memmove(in->data + length, in->data + in->start, kept);
+    memcpy(in->data, data, length);
+    in->start = 0;
+    in->end = kept + length;
+    return true;
+}
+
+// inflate the DEFLATE data of one member from *in*, handing it to *write*, and
+// check it against the trailer that follows
+static bool stream_pipe_member(pipe_input *in, nflate_stream *s, uint8_t *buffer, members_writer write, void *context) {
+    nflate_status status;
+    uint64_t total = 0;
+    for (;;) {
+        in->start += nflate_stream_feed(s, in->data + in->start, in->end - in->start);
+        size_t produced;
+        do {
+            status = nflate_stream_drain(s, buffer, STREAM_BUFFER_SIZE, &produced);
+            if (produced > 0 && !write(buffer, produced, context)) {
+                return false;
+            }
+            total += produced;
+        } while (status == NFLATE_OK);
+        if (status != NFLATE_NEEDS_INPUT) {
+            break;
+        }
+        if (in->start == in->end && !read_more(in)) {
+            fprintf(stderr, "Error, compressed data ended before the final block.\n");
+            return false;
+        }
+    }
+    if (status != NFLATE_DONE) {
+        return false;
+    }
+
+    // whatever the stream read past the end of the DEFLATE data starts the trailer
+    const uint8_t *unused;
+    size_t unused_length = nflate_stream_unused_input(s, &unused);
+    if (!unread(in, unused, unused_length)) {
+        fprintf(stderr, "Error allocating memory for input.\n");
+        return false;
+    }
+    while (in->end - in->start < TRAILER_LENGTH) {
+        if (!read_more(in)) {
+            fprintf(stderr, "Error, member is missing its trailer.\n");
+            return false;
+        }
+    }
+    uint32_t CRC32 = gzip_read_le32(in->data + in->start);
+    uint32_t ISIZE = gzip_read_le32(in->data + in->start + 4);
+    in->start += TRAILER_LENGTH;
+    if (nflate_stream_crc32(s) != CRC32) {
+        fprintf(stderr, "CRC32 check did not pass on data.\n");
+        return false;
+    }
+    if ((uint32_t)total != ISIZE) {
+        fprintf(stderr, "ISIZE check did not pass on data.\n");
+        return false;
+    }
+    return true;
+}
+
+bool inflate_members_from_file(FILE *input, members_writer write, void *context) {
+    pipe_input in = {input, malloc(STREAM_BUFFER_SIZE), STREAM_BUFFER_SIZE, 0, 0, false};
+    uint8_t *buffer = malloc(STREAM_BUFFER_SIZE);
+    if (in.data == NULL || buffer == NULL) {
+        fprintf(stderr, "Error allocating memory for input.\n");
+        free(in.data);
+        free(buffer);
+        return false;
+    }
+
+    bool success = true;
+    size_t num_members = 0;
+    for (;;) {
+        // read until there is a whole header, or it's clear there isn't one
+        size_t header_length;
+        while ((header_length = gzip_header_scan(in.data + in.start, in.end - in.start)) == GZIP_HEADER_INCOMPLETE) {
+            if (!read_more(&in)) {
+                break;
+            }
+        }
+        if (header_length == GZIP_HEADER_INCOMPLETE && in.start == in.end && num_members > 0) {
+            break; // the end of the last member was the end of the input
+        }
+        if (header_length == 0 || header_length == GZIP_HEADER_INCOMPLETE) {
+            if (num_members == 0) {
+                fprintf(stderr, "Error, the input isn't gzip data.\n");
+                success = false;
+            } else {
+                // drain the rest so the writer of the pipe isn't cut off
+                bool zeros = true;
+                do {
+                    zeros = zeros && all_zeros(in.data + in.start, in.end - in.start);
+                    in.start = in.end;
+                } while (read_more(&in));
+                if (!zeros) {
+                    fprintf(stderr, "Ignoring trailing garbage after the last member.\n");
+                }
+            }
+            break;
+        }
+        in.start += header_length;
+
+        nflate_stream *s = nflate_stream_init();
+        if (s == NULL) {
+            fprintf(stderr, "Error allocating memory for stream.\n");
+            success = false;
+            break;
+        }
+        bool inflated = stream_pipe_member(&in, s, buffer, write, context);
+        nflate_stream_end(s);
+        if (!inflated) {
+            success = false;
+            break;
+        }
+        num_members++;
+    }
+    free(in.data);
+    free(buffer);
+    return success;
+}
@@ -0,0 +1,51 @@
+//
+//  members.h
+//  nflate
+//
+//  Copyright (c) 2020 David Kopec
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+// Inflating gzip files made of several members, as written by pigz, log
+// rotators, or just cat a.gz b.gz > ab.gz (RFC 1952 section 2.2)
+
+#ifndef members_h
+#define members_h
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "gzipfile.h"
+
+// receives the output of each member in order
+// returns false to stop inflating
+typedef bool (*members_writer)(const uint8_t *data, size_t length, void *context);
+
+// inflate every member of *gzf* one after another, handing their output to
+// *write* along with *context* a piece at a time as it is decoded
+// with *num_threads* > 1, places in the file that look like the start of a
+// member are inflated ahead of time on that many threads, each into a buffer of
+// its own; their output is still handed over strictly in file order, and only
+// once an earlier member is found to end exactly where they start
+// bytes after the last member that aren't another member are ignored with a warning
+// returns false if a member couldn't be inflated, its CRC-32 or size doesn't
+// match its trailer, or *write* failed
+bool inflate_members(gzipfile *gzf, int num_threads, members_writer write, void *context);
+
+// inflate the gzip members read from *input*, such as standard input, strictly
+// in order as the data arrives, without needing to know its length
+// returns false if the input isn't valid gzip data or *write* failed
+bool inflate_members_from_file(FILE *input, members_writer write, void *context);
+
+#endif /* members_h */
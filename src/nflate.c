@@ -18,169 +18,521 @@
 
 
 #include <stdio.h>
+#include <string.h>
 #include "nflate.h"
 #include "bitstream.h"
-#include "binarytree.h"
+#include "huffman.h"
+#include "crc32.h"
+#include "thread.h"
 
 // Based on RFC 1951
 // https://tools.ietf.org/html/rfc1951
 
 
-#define MAX_BITS 16
 #define NUM_LIT_LEN_SYMBOLS 288
-#define NO_SYMBOL 65535
+#define NUM_DIST_SYMBOLS 32
+#define NUM_CODE_LENGTH_SYMBOLS 19
+#define MAX_CODE_LENGTH_BITS 7 // code length codes are at most this long
 #define END_OF_BLOCK 256
+// length symbols decode to this plus the length, so they come after END_OF_BLOCK
+#define LENGTH_VALUE_OFFSET 256
 
-// generate huffman code tree
-// code prior to tree creation adapted from RFC 1951 section 3.2.2
-// https://tools.ietf.org/html/rfc1951
-static void generate_tree(uint8_t *code_lengths, bt *tree_root, int num_symbols) {
-    int bl_count[MAX_BITS] = {0};
-    for (int i = 0; i < num_symbols; i++) {
-        bl_count[code_lengths[i]]++;
-    }
-    
-    uint16_t code = 0;
-    bl_count[0] = 0;
-    uint16_t next_code[MAX_BITS + 1] = {0};
-    for (uint16_t bits = 1; bits <= MAX_BITS; bits++) {
-        code = (code + bl_count[bits-1]) << 1;
-        next_code[bits] = code;
-    }
-    
-    for (uint16_t n = 0; n < num_symbols; n++) {
-        uint8_t len = code_lengths[n];
-        if (len != 0) {
-            uint16_t code = next_code[len];
-            // add node to tree
-            bt *current = tree_root;
-            for (int i = (len - 1); i >= 0; i--) {
-                bool bit = (code & (1 << i));
-                if (bit) { // 1, right
-                    if (current->right == NULL) {
-                        if (i == 0) {
-                            current->right = bt_create(n);
-                        } else {
-                            current->right = bt_create(NO_SYMBOL);
-                        }
-                    }
-                    current = current->right;
-                } else { // 0, left
-                    if (current->left == NULL) {
-                        if (i == 0) {
-                            current->left = bt_create(n);
-                        } else {
-                            current->left = bt_create(NO_SYMBOL);
-                        }
-                    }
-                    current = current->left;
-                }
-            }
-            //printf("%d \t %d \t %d\n", code, n, current->value);
-            next_code[len]++;
-        }
+// widths of the primary decode tables; most codes are shorter than these so
+// they decode in a single table probe
+#define LIT_LEN_ROOT_BITS 10
+#define DIST_ROOT_BITS 8
+#define CODE_LENGTH_ROOT_BITS 7
+// room for the tables of any one block
+#define ARENA_SIZE (HUFFMAN_MAX_ENTRIES(NUM_LIT_LEN_SYMBOLS, LIT_LEN_ROOT_BITS, HUFFMAN_MAX_BITS) + \
+                    HUFFMAN_MAX_ENTRIES(NUM_DIST_SYMBOLS, DIST_ROOT_BITS, HUFFMAN_MAX_BITS) + \
+                    HUFFMAN_MAX_ENTRIES(NUM_CODE_LENGTH_SYMBOLS, CODE_LENGTH_ROOT_BITS, MAX_CODE_LENGTH_BITS))
+
+#define WINDOW_SIZE 32768 // farthest a back-reference can reach
+#define MAX_MATCH 258
+#define MATCH_COPY_SLACK 32 // copy_match may write this far past the end of a match
+#define STREAM_INPUT_SIZE 65536
+#define STREAM_OUTPUT_SIZE (4 * WINDOW_SIZE)
+#define CRC_CHUNK_SIZE 65536 // output is checksummed in pieces this big while still in cache
+
+typedef enum {
+    BLOCK_HEADER, // the next bits are BFINAL and BTYPE of a block
+    STORED_BLOCK, // copying the bytes of an uncompressed block
+    HUFFMAN_BLOCK, // decoding the symbols of a fixed or dynamic block
+    STREAM_DONE,
+    STREAM_ERROR
+} stream_state;
+
+// Everything needed to pick decoding back up where it left off. Input comes
+// from bs and output goes to output at output_pos; all of the output before
+// output_pos is history that back-references may point into.
+struct nflate_stream {
+    stream_state state;
+    bool BFINAL; // name comes from RFC 1951, is the current block the last one?
+    bitstream bs;
+    const huffman_table *lit_len_table; // tables of the current block, NULL between blocks
+    const huffman_table *dist_table;
+    huffman_table lit_len_storage;
+    huffman_table dist_storage;
+    huffman_arena arena; // entries of the tables of the current block, reused from block to block
+    size_t stored_remaining; // bytes of the current uncompressed block still to copy
+
+    uint8_t *output;
+    size_t output_size;
+    size_t output_pos;
+    bool compute_crc;
+    uint32_t crc; // running CRC-32 of all output so far when compute_crc is set
+    bool quiet; // don't print errors, the data is only being tried out
+    bool strict; // reject dynamic blocks with incomplete codes, which real encoders never write
+    uint64_t stop_bit; // stop at the first block that starts at or after this bit
+    uint16_t *markers; // when set, output goes here instead, with markers for unknown history
+
+    // only used by the streaming interface
+    uint8_t *input;
+    size_t drain_pos; // first byte of output not yet handed to the caller
+    uint64_t input_dropped; // bytes of input discarded from the front of the input buffer
+    uint64_t output_dropped; // bytes of output slid out of the window
+    size_t primed; // bytes at the start of output that came from nflate_stream_prime()
+    nflate_block_callback on_block;
+    void *on_block_context;
+    bool block_reported; // on_block has been called for the block about to start
+
+#ifdef NFLATE_STATS
+    nflate_stats stats; // counted since the stream started, added to the totals when it ends
+#endif
+};
+
+#ifdef NFLATE_STATS
+#define STATS(statement) statement
+#else
+#define STATS(statement)
+#endif
+
+static nflate_status fail(nflate_stream *s, const char *message) {
+    if (!s->quiet) {
+        fprintf(stderr, "%s", message);
     }
+    s->state = STREAM_ERROR;
+    return NFLATE_DATA_ERROR;
 }
 
-static uint16_t get_symbol(bitstream *bs, bt *root) {
-    bt *current = root;
-    do {
-        current = bs_read_bit(bs) ? current->right : current->left;
-    } while ((current->left != NULL) || (current->right != NULL));
-    return current->value;
+// the tables of a block are done with once it ends, but their storage is kept for the next one
+static void reset_tables(nflate_stream *s) {
+    s->lit_len_table = NULL;
+    s->dist_table = NULL;
+    huffman_arena_reset(&s->arena);
+}
+
+// give back the storage for tables once decoding is over
+static void free_tables(nflate_stream *s) {
+    reset_tables(s);
+    huffman_arena_free(&s->arena);
+}
+
+// set up the arena the first time a block needs tables
+static bool ensure_arena(nflate_stream *s) {
+    return s->arena.entries != NULL || huffman_arena_init(&s->arena, ARENA_SIZE);
+}
+
+static void end_block(nflate_stream *s) {
+    reset_tables(s);
+    s->state = s->BFINAL ? STREAM_DONE : BLOCK_HEADER;
+}
+
+#ifdef NFLATE_STATS
+static nflate_stats totals;
+static thread_mutex totals_mutex;
+static thread_once_flag totals_once = THREAD_ONCE_INIT;
+
+static void init_totals(void) {
+    thread_mutex_init(&totals_mutex);
+}
+
+// the histogram bucket of *value*, floor(log2(value))
+static int stats_bucket(uint32_t value) {
+    int bucket = 0;
+    while (value >>= 1) {
+        bucket++;
+    }
+    return bucket;
+}
+
+static void count_match(nflate_stream *s, int length, int distance) {
+    s->stats.matches++;
+    s->stats.match_bytes += length;
+    s->stats.length_histogram[stats_bucket(length)]++;
+    s->stats.distance_histogram[stats_bucket(distance)]++;
+}
+
+// add what *s* counted to the totals and start it over from zero
+static void add_to_totals(nflate_stream *s) {
+    thread_once(&totals_once, init_totals);
+    thread_mutex_lock(&totals_mutex);
+    for (int i = 0; i < 3; i++) {
+        totals.blocks[i] += s->stats.blocks[i];
+    }
+    totals.literals += s->stats.literals;
+    totals.matches += s->stats.matches;
+    totals.match_bytes += s->stats.match_bytes;
+    totals.stored_bytes += s->stats.stored_bytes;
+    for (int i = 0; i < NFLATE_STATS_LENGTH_BUCKETS; i++) {
+        totals.length_histogram[i] += s->stats.length_histogram[i];
+    }
+    for (int i = 0; i < NFLATE_STATS_DISTANCE_BUCKETS; i++) {
+        totals.distance_histogram[i] += s->stats.distance_histogram[i];
+    }
+    totals.header_seconds += s->stats.header_seconds;
+    totals.table_seconds += s->stats.table_seconds;
+    totals.huffman_seconds += s->stats.huffman_seconds;
+    totals.stored_seconds += s->stats.stored_seconds;
+    totals.crc_seconds += s->stats.crc_seconds;
+    thread_mutex_unlock(&totals_mutex);
+    memset(&s->stats, 0, sizeof(nflate_stats));
+}
+
+void nflate_stats_get(nflate_stats *stats) {
+    thread_once(&totals_once, init_totals);
+    thread_mutex_lock(&totals_mutex);
+    *stats = totals;
+    thread_mutex_unlock(&totals_mutex);
 }
 
-static void expand(bitstream *bs, bt *len_lit_tree, bt *dist_tree, uint8_t **output_buffer, size_t *output_buffer_length) {
-    // must have some starting space; arbitrarily start with 1024 bytes
-    size_t insert_location = 0;
-    if (*output_buffer == NULL) {
-        *output_buffer = realloc(*output_buffer, 1024);
-        *output_buffer_length = 1024;
+void nflate_stats_reset(void) {
+    thread_once(&totals_once, init_totals);
+    thread_mutex_lock(&totals_mutex);
+    memset(&totals, 0, sizeof(nflate_stats));
+    thread_mutex_unlock(&totals_mutex);
+}
+#endif
+
+// copy a back-reference of *length* bytes starting *distance* bytes back
+// works in whole chunks, so it may write up to MATCH_COPY_SLACK bytes past the end of the match
+static inline void copy_match(uint8_t *dest, size_t distance, size_t length) {
+    const uint8_t *src = dest - distance;
+    uint8_t *end = dest + length;
+    if (distance >= 32) {
+        // a chunk never reads bytes that the same chunk writes
+        do {
+            memcpy(dest, src, 32);
+            dest += 32;
+            src += 32;
+        } while (dest < end);
+    } else if (distance >= 16) {
+        do {
+            memcpy(dest, src, 16);
+            dest += 16;
+            src += 16;
+        } while (dest < end);
+    } else if (distance >= 8) {
+        do {
+            memcpy(dest, src, 8);
+            dest += 8;
+            src += 8;
+        } while (dest < end);
+    } else if (distance == 1) {
+        // a run of a single byte
+        uint64_t run = 0x0101010101010101ULL * src[0];
+        do {
+            memcpy(dest, &run, 8);
+            dest += 8;
+        } while (dest < end);
     } else {
-        insert_location = *output_buffer_length;
+        // shorter distances repeat a pattern of *distance* bytes; lay it out
+        // twice over so any 8 bytes of the repetition can be copied from it
+        uint8_t pattern[16];
+        for (int i = 0; i < 16; i++) {
+            pattern[i] = src[i % distance];
+        }
+        size_t offset = 0;
+        size_t advance = 8 % distance;
+        do {
+            memcpy(dest, pattern + offset, 8);
+            dest += 8;
+            offset += advance;
+            if (offset >= distance) {
+                offset -= distance;
+            }
+        } while (dest < end);
     }
-    
-    
-    uint16_t last_symbol = 0;
-    do {
-        
-        last_symbol = get_symbol(bs, len_lit_tree);
-        
-        if (last_symbol < 256) { // literal
-            if (insert_location == *output_buffer_length) {
-                *output_buffer_length *= 2;
-                *output_buffer = realloc(*output_buffer, *output_buffer_length);
+}
+
+// figure out the length and distance of the back-reference started by *symbol*
+// the literal/length and distance tables decode straight to lengths and
+// distances, extra bits included, so this only has to check them
+// returns an error message if the codes are invalid
+static inline const char *decode_match(bitstream *bs, uint16_t symbol, const huffman_table *dist_table, int *length, int *distance) {
+    if (symbol > LENGTH_VALUE_OFFSET + MAX_MATCH) {
+        return "Error, found unexpected symbol > 285.\n";
+    }
+    *length = symbol - LENGTH_VALUE_OFFSET;
+    uint16_t value = huffman_decode(bs, dist_table);
+    if (value > WINDOW_SIZE) {
+        return "Error, found unexpected distance code > 29.\n";
+    }
+    *distance = value;
+    return NULL;
+}
+
+// decode symbols until the end of the block, or until the input or the room for output runs out
+static nflate_status expand(nflate_stream *s) {
+    bitstream *bs = &s->bs;
+    uint8_t *output = s->output;
+    size_t insert_location = s->output_pos;
+    nflate_status status = NFLATE_OK;
+    const char *error = NULL;
+    int length = 0;
+    int distance = 0;
+
+    for (;;) {
+        // fast path: while a refill is a full word load and the largest match
+        // plus copy overshoot fits, no symbol can run out of input or room
+        while ((bs->byteIndex + 8 <= bs->byteLength) &&
+               (s->output_size - insert_location >= MAX_MATCH + MATCH_COPY_SLACK)) {
+            // one refill covers the longest literal/length code, its extra bits,
+            // the longest distance code and its extra bits (15 + 5 + 15 + 13 bits)
+            bs_refill(bs);
+            // literals come straight out of the primary table, short ones two
+            // at a time; both bytes are always stored, and a lone literal
+            // leaves the second for the next symbol to overwrite
+            huffman_entry entry = huffman_root_entry(bs, s->lit_len_table);
+            if (entry.extra & HUFFMAN_LITERALS) {
+                output[insert_location] = (uint8_t)entry.value;
+                output[insert_location + 1] = (uint8_t)(entry.value >> 8);
+                insert_location += (entry.extra & HUFFMAN_PAIR) ? 2 : 1;
+                bs_consume_bits(bs, entry.bits);
+                STATS(s->stats.literals += (entry.extra & HUFFMAN_PAIR) ? 2 : 1);
+                continue;
             }
-            (*output_buffer)[insert_location] = (uint8_t)last_symbol;
-            insert_location++;
-        } else if (last_symbol == 256) {
-            break; // END_OF_BLOCK symbol
-        } else if (last_symbol < 286) { // length, distance pair
-            // figure out length
-            int length = 0;
-            if (last_symbol < 265) {
-                length = last_symbol - 257 + 3;
-            } else if (last_symbol < 285) {
-                int difference = last_symbol - 257;
-                int extra_bits = (difference / 4) - 1;
-                // length = 2 ^ (extra_bits + 2) + (2 ^ extra_bits * (difference % 4)) + 3
-                int additional_amount = (int)bs_read_bits_rev(bs, extra_bits);
-                int starter_length = (1 << (extra_bits + 2)) + ((1 << extra_bits) * (difference % 4)) + 3;
-                length = starter_length + additional_amount;
-            } else if (last_symbol == 285) {
-                length = 258;
-            } else {
-                fprintf(stderr, "Error, found unexpected symbol > 285.");
+            uint16_t last_symbol = huffman_decode_entry(bs, s->lit_len_table, entry);
+            if (last_symbol < 256) { // literal
+                output[insert_location] = (uint8_t)last_symbol;
+                insert_location++;
+                STATS(s->stats.literals++);
+                continue;
+            }
+            if (last_symbol == END_OF_BLOCK) {
+                end_block(s);
+                goto done;
             }
-            
-            // figure out distance
-            uint16_t distance_code = 0;
-            int distance = 0;
-            if (dist_tree == NULL) { // must be fixed distances of 5 bit each (fixed block)
-                distance_code = (uint8_t)bs_read_bits_rev(bs, 5);
-            } else { // dynamic distance must be read
-                distance_code = get_symbol(bs, dist_tree);
+            error = decode_match(bs, last_symbol, s->dist_table, &length, &distance);
+            if (error == NULL && (size_t)distance > insert_location) {
+                error = "Error, distance refers to before the start of the data.\n";
             }
-            if (distance_code < 4) {
-                distance = distance_code + 1;
-            } else if (distance_code < 30) {
-                int extra_bits = ((distance_code / 2)) - 1;
-                int additional_amount = (int)bs_read_bits_rev(bs, extra_bits);
-                // distance = 2 ^ (extra_bits + 1) + (2 ^ extra_bits * (distance_code % 2)) + 1
-                int starter_distance = (1 << (extra_bits + 1)) + ((1 << extra_bits) * (distance_code % 2)) + 1;
-                distance = starter_distance + additional_amount;
-            } else {
-                fprintf(stderr, "Error, found unexpected distance code > 29.");
+            if (error != NULL) {
+                status = fail(s, error);
+                goto done;
             }
-            
-            // make sure we have enough room
-            if ((insert_location + length) >= *output_buffer_length) {
-                *output_buffer_length *= 2;
-                *output_buffer_length += length;
-                *output_buffer = realloc(*output_buffer, *output_buffer_length);
+            copy_match(output + insert_location, distance, length);
+            insert_location += length;
+            STATS(count_match(s, length, distance));
+        }
+
+        // careful path for the last few bytes of input or room: a symbol is
+        // only committed once all of its bits turned out to be there and its
+        // output fits, otherwise the bitstream is put back to where it started
+        bitstream saved = *bs;
+        bs_refill(bs);
+        uint16_t last_symbol = huffman_decode(bs, s->lit_len_table);
+        length = 1;
+        error = NULL;
+        if (last_symbol == END_OF_BLOCK) {
+            length = 0;
+        } else if (last_symbol > 256) {
+            error = decode_match(bs, last_symbol, s->dist_table, &length, &distance);
+        }
+
+        // the symbol only counts if all of its bits were really there
+        if (bs_overrun(bs)) {
+            *bs = saved;
+            status = NFLATE_NEEDS_INPUT;
+            break;
+        }
+        if (error != NULL) {
+            status = fail(s, error);
+            break;
+        }
+        if ((s->output_size - insert_location) < (size_t)length) {
+            *bs = saved;
+            status = NFLATE_NEEDS_OUTPUT;
+            break;
+        }
+
+        if (last_symbol < 256) {
+            output[insert_location] = (uint8_t)last_symbol;
+            insert_location++;
+            STATS(s->stats.literals++);
+        } else if (last_symbol == END_OF_BLOCK) {
+            end_block(s);
+            break;
+        } else {
+            if ((size_t)distance > insert_location) {
+                status = fail(s, "Error, distance refers to before the start of the data.\n");
+                break;
             }
-            
-            // copy over bytes
+            // no room for overshoot here, so copy byte by byte
             for (int i = 0; i < length; i++) {
-                (*output_buffer)[insert_location] = (*output_buffer)[insert_location - distance];
+                output[insert_location] = output[insert_location - distance];
                 insert_location++;
             }
-            
-        } else {
-            fprintf(stderr, "Error, found unexpected symbol > 285.");
+            STATS(count_match(s, length, distance));
+        }
+    }
+
+done:
+    s->output_pos = insert_location;
+    return status;
+}
+
+// Speculative decoding
+// A chunk decoded from the middle of DEFLATE data doesn't know the 32 KB of
+// output before it, so in marker mode each output symbol is 16 bits: a byte
+// value, or NFLATE_MARKER_BASE plus the position of a byte in that unknown
+// window, to be filled in once the window is known.
+
+// like expand(), but into s->markers, where there is never any input to run
+// out of since all of the data to the end is at hand
+static nflate_status expand_markers(nflate_stream *s) {
+    bitstream *bs = &s->bs;
+    uint16_t *output = s->markers;
+    size_t insert_location = s->output_pos;
+    nflate_status status = NFLATE_OK;
+    int length = 0;
+    int distance = 0;
+
+    for (;;) {
+        if (s->output_size - insert_location < MAX_MATCH) {
+            status = NFLATE_NEEDS_OUTPUT;
             break;
         }
-        
-    } while (last_symbol != END_OF_BLOCK);
-    
-    // get rid of excess
-    *output_buffer_length = insert_location;
-    *output_buffer = realloc(*output_buffer, *output_buffer_length);
+        bs_refill(bs);
+        uint16_t last_symbol = huffman_decode(bs, s->lit_len_table);
+        const char *error = NULL;
+        if (last_symbol > END_OF_BLOCK) {
+            error = decode_match(bs, last_symbol, s->dist_table, &length, &distance);
+        }
+        if (bs_overrun(bs)) {
+            status = NFLATE_NEEDS_INPUT;
+            break;
+        }
+        if (error == NULL && last_symbol > END_OF_BLOCK && (size_t)distance > insert_location + WINDOW_SIZE) {
+            error = "Error, distance refers to before the start of the window.\n";
+        }
+        if (error != NULL) {
+            status = fail(s, error);
+            break;
+        }
+
+        if (last_symbol < 256) {
+            output[insert_location] = last_symbol;
+            insert_location++;
+            STATS(s->stats.literals++);
+        } else if (last_symbol == END_OF_BLOCK) {
+            end_block(s);
+            break;
+        } else if ((size_t)distance <= insert_location) {
+            for (int i = 0; i < length; i++) {
+                output[insert_location] = output[insert_location - distance];
+                insert_location++;
+            }
+            STATS(count_match(s, length, distance));
+        } else {
+            // the match starts in the unknown window and may run on into the chunk's own output
+            for (int i = 0; i < length; i++) {
+                if ((size_t)distance > insert_location) {
+                    output[insert_location] = (uint16_t)(NFLATE_MARKER_BASE + WINDOW_SIZE + insert_location - distance);
+                } else {
+                    output[insert_location] = output[insert_location - distance];
+                }
+                insert_location++;
+            }
+            STATS(count_match(s, length, distance));
+        }
+    }
+
+    s->output_pos = insert_location;
+    return status;
+}
+
+// like copy_uncompressed(), but widening the bytes into s->markers
+static nflate_status copy_uncompressed_markers(nflate_stream *s) {
+    size_t available = (size_t)(bs_bits_left(&s->bs) / 8);
+    size_t room = s->output_size - s->output_pos;
+    size_t amount = s->stored_remaining;
+    if (amount > available) {
+        amount = available;
+    }
+    if (amount > room) {
+        amount = room;
+    }
+    uint8_t bytes[4096];
+    for (size_t copied = 0; copied < amount;) {
+        size_t piece = (amount - copied < sizeof(bytes)) ? amount - copied : sizeof(bytes);
+        bs_read_bytes(&s->bs, bytes, piece);
+        for (size_t i = 0; i < piece; i++) {
+            s->markers[s->output_pos + copied + i] = bytes[i];
+        }
+        copied += piece;
+    }
+    s->output_pos += amount;
+    s->stored_remaining -= amount;
+    STATS(s->stats.stored_bytes += amount);
+    if (s->stored_remaining == 0) {
+        end_block(s);
+        return NFLATE_OK;
+    }
+    return (amount == available) ? NFLATE_NEEDS_INPUT : NFLATE_NEEDS_OUTPUT;
+}
+
+// The fixed codes never change, so their tables are built once, the first
+// time any thread needs them, and shared by every fixed block from then on,
+// along with what every literal/length and distance symbol decodes to.
+// Every fixed code is no longer than the root bits, so no sub-tables are needed.
+#define FIXED_TABLE_ENTRIES ((1 << LIT_LEN_ROOT_BITS) + (1 << DIST_ROOT_BITS))
+static huffman_entry fixed_entries[FIXED_TABLE_ENTRIES];
+static huffman_table fixed_lit_len_table;
+static huffman_table fixed_dist_table;
+static huffman_value lit_len_values[NUM_LIT_LEN_SYMBOLS];
+static huffman_value dist_values[NUM_DIST_SYMBOLS];
+static bool static_tables_built = false;
+static thread_once_flag static_tables_once = THREAD_ONCE_INIT;
+
+// this is specified by RFC 1951 section 3.2.5
+static void fill_values(void) {
+    for (int symbol = 0; symbol < NUM_LIT_LEN_SYMBOLS; symbol++) {
+        huffman_value value = {(uint16_t)symbol, 0}; // literals and the end of block stand for themselves
+        if (symbol > 285) {
+            value.base = HUFFMAN_INVALID_SYMBOL;
+        } else if (symbol == 285) {
+            value.base = LENGTH_VALUE_OFFSET + MAX_MATCH;
+        } else if (symbol >= 265) {
+            int difference = symbol - 257;
+            int extra_bits = (difference / 4) - 1;
+            // length = 2 ^ (extra_bits + 2) + (2 ^ extra_bits * (difference % 4)) + 3
+            value.base = (uint16_t)(LENGTH_VALUE_OFFSET + (1 << (extra_bits + 2)) + ((1 << extra_bits) * (difference % 4)) + 3);
+            value.extra_bits = (uint8_t)extra_bits;
+        } else if (symbol > END_OF_BLOCK) {
+            value.base = (uint16_t)(LENGTH_VALUE_OFFSET + symbol - 257 + 3);
+        }
+        lit_len_values[symbol] = value;
+    }
+    for (int code = 0; code < NUM_DIST_SYMBOLS; code++) {
+        huffman_value value = {(uint16_t)(code + 1), 0};
+        if (code >= 30) {
+            value.base = HUFFMAN_INVALID_SYMBOL;
+        } else if (code >= 4) {
+            int extra_bits = (code / 2) - 1;
+            // distance = 2 ^ (extra_bits + 1) + (2 ^ extra_bits * (distance_code % 2)) + 1
+            value.base = (uint16_t)((1 << (extra_bits + 1)) + ((1 << extra_bits) * (code % 2)) + 1);
+            value.extra_bits = (uint8_t)extra_bits;
+        }
+        dist_values[code] = value;
+    }
 }
 
 // this is specified by RFC 1951 section 3.2.6
-static void nflate_fixed_block(bitstream *bs, uint8_t **output_buffer, size_t *output_buffer_length) {
-    uint8_t *code_lengths = calloc(NUM_LIT_LEN_SYMBOLS, 1);
+static void build_static_tables(void) {
+    fill_values();
+    huffman_arena arena = {fixed_entries, FIXED_TABLE_ENTRIES, 0};
+    uint8_t code_lengths[NUM_LIT_LEN_SYMBOLS];
     // build fixed table
     for (int i = 0; i < NUM_LIT_LEN_SYMBOLS; i++) {
         if (i < 144) {
@@ -193,159 +545,682 @@ static void nflate_fixed_block(bitstream *bs, uint8_t **output_buffer, size_t *o
             code_lengths[i] = 8;
         }
     }
-    
+    bool built = huffman_table_build(&fixed_lit_len_table, &arena, code_lengths, NUM_LIT_LEN_SYMBOLS, LIT_LEN_ROOT_BITS, lit_len_values);
+    if (built) {
+        huffman_table_pair_literals(&fixed_lit_len_table);
+    }
 
-    bt *lit_len_tree_root = bt_create(NO_SYMBOL);
-    generate_tree(code_lengths, lit_len_tree_root, NUM_LIT_LEN_SYMBOLS);
-    
-    expand(bs, lit_len_tree_root, NULL, output_buffer, output_buffer_length);
-    
-    
-    free(code_lengths);
-    bt_free(lit_len_tree_root);
+    // distance codes are all 5 bits, which as a canonical code is just the
+    // distance code itself written most significant bit first
+    for (int i = 0; i < NUM_DIST_SYMBOLS; i++) {
+        code_lengths[i] = 5;
+    }
+    built = built && huffman_table_build(&fixed_dist_table, &arena, code_lengths, NUM_DIST_SYMBOLS, DIST_ROOT_BITS, dist_values);
+    static_tables_built = built;
+}
+
+static const char *start_fixed_block(nflate_stream *s) {
+    thread_once(&static_tables_once, build_static_tables);
+    if (!static_tables_built) {
+        return "Error building fixed Huffman tables.\n";
+    }
+    s->lit_len_table = &fixed_lit_len_table;
+    s->dist_table = &fixed_dist_table;
+    return NULL;
 }
 
 // this is specified by RFC 1951 section 3.2.7
-static uint8_t *process_dynamic_huffman_code_lengths(bitstream *bs, bt *huffman_tree, int alphabet_size) {
-    uint8_t *code_lengths = calloc(alphabet_size, 1);
+// the literal/length and distance code lengths form one sequence, so a
+// repeat may carry over from one into the other
+static const char *process_dynamic_huffman_code_lengths(bitstream *bs, const huffman_table *code_length_table, uint8_t *code_lengths, int alphabet_size) {
     uint16_t symbol = 0;
     int num_processed = 0;
     do {
-        symbol = get_symbol(bs, huffman_tree);
+        // enough for the longest code length code (7 bits) plus its extra bits (7 bits)
+        bs_refill(bs);
+        symbol = huffman_decode(bs, code_length_table);
+        int repeat = 0;
+        uint8_t repeated_length = 0;
         if (symbol < 16) {
             code_lengths[num_processed] = symbol;
             num_processed++;
         } else if (symbol == 16) {
-            int extra = ((int)bs_read_bits_rev(bs, 2)) + 3;
-            for (int i = 0; i < extra; i++) {
-                code_lengths[num_processed] = code_lengths[num_processed-1];
-                num_processed++;
+            if (num_processed == 0) {
+                return "Error, repeat of previous code length with no previous length.\n";
             }
+            repeat = ((int)bs_pop_bits_rev(bs, 2)) + 3;
+            repeated_length = code_lengths[num_processed-1];
         } else if (symbol == 17) {
-            int extra = ((int)bs_read_bits_rev(bs, 3)) + 3;
-            for (int i = 0; i < extra; i++) {
-                code_lengths[num_processed] = 0;
-                num_processed++;
-            }
+            repeat = ((int)bs_pop_bits_rev(bs, 3)) + 3;
         } else if (symbol == 18) {
-            int extra = ((int)bs_read_bits_rev(bs, 7)) + 11;
-            for (int i = 0; i < extra; i++) {
-                code_lengths[num_processed] = 0;
-                num_processed++;
-            }
+            repeat = ((int)bs_pop_bits_rev(bs, 7)) + 11;
         } else {
-            fprintf(stderr, "Error, found unexpected symbol > 18 reading lit/length table.\n");
+            return "Error, found unexpected symbol > 18 reading lit/length table.\n";
+        }
+        if (num_processed + repeat > alphabet_size) {
+            return "Error, code length repeat runs past the end of the table.\n";
+        }
+        for (int i = 0; i < repeat; i++) {
+            code_lengths[num_processed] = repeated_length;
+            num_processed++;
         }
-        
     } while (num_processed < alphabet_size);
-    
-    return code_lengths;
+
+    return NULL;
 }
 
 // this is specified by RFC 1951 section 3.2.7
-static void nflate_dynamic_block(bitstream *bs, uint8_t **output_buffer, size_t *output_buffer_length) {
+static const char *start_dynamic_block(nflate_stream *s) {
+    bitstream *bs = &s->bs;
     // build dynamic tables
     int HLIT = ((int)bs_read_bits_rev(bs, 5)) + 257; // name comes from RFC 1951
     int HDIST = ((int)bs_read_bits_rev(bs, 5)) + 1; // name comes from RFC 1951
     int HCLEN = ((int)bs_read_bits_rev(bs, 4)) + 4; // name comes from RFC 1951
-    
+    if (HLIT > 286 || HDIST > 30) {
+        return "Error, too many literal/length or distance codes.\n";
+    }
+    thread_once(&static_tables_once, build_static_tables);
+    if (!static_tables_built || !ensure_arena(s)) {
+        return "Error allocating memory for Huffman tables.\n";
+    }
+
     // build code length alphabet
-    uint8_t *code_lengths = calloc(19, 1);
-    int code_length_indices[19] = {16, 17, 18,
+    uint8_t code_lengths[NUM_CODE_LENGTH_SYMBOLS] = {0};
+    uint8_t lit_len_dist_code_lengths[NUM_LIT_LEN_SYMBOLS + NUM_DIST_SYMBOLS];
+    int code_length_indices[NUM_CODE_LENGTH_SYMBOLS] = {16, 17, 18,
         0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
     for (int i = 0; i < HCLEN; i++) {
         uint8_t code_length = bs_read_bits_rev(bs, 3);
         code_lengths[code_length_indices[i]] = code_length;
     }
-    
-//    for (int i = 0; i < 19; i++) {
-//        printf("%d \t %d\n", i, code_lengths[i]);
-//    }
-
-    bt *huffman_tree = bt_create(NO_SYMBOL);
-    
-    generate_tree(code_lengths, huffman_tree, 19);
-        
-    // build literal/length tree
-    uint8_t *lit_len_code_lengths = process_dynamic_huffman_code_lengths(bs, huffman_tree, HLIT);
-    bt *lit_len_tree = bt_create(NO_SYMBOL);
-    generate_tree(lit_len_code_lengths, lit_len_tree, HLIT);
-
-    // build distance tree
-    uint8_t *dist_code_lengths = process_dynamic_huffman_code_lengths(bs, huffman_tree, HDIST);
-    bt *dist_tree = bt_create(NO_SYMBOL);
-    generate_tree(dist_code_lengths, dist_tree, HDIST);
-    
-    expand(bs, lit_len_tree, dist_tree, output_buffer, output_buffer_length);
-    
-    free(code_lengths);
-    bt_free(huffman_tree);
-    free(lit_len_code_lengths);
-    bt_free(lit_len_tree);
-    free(dist_code_lengths);
-    bt_free(dist_tree);
+
+    // the code length table is only needed while reading the other two, but
+    // lives in the arena with them until the block ends
+    huffman_table code_length_table;
+    if (s->strict && !huffman_code_complete(code_lengths, NUM_CODE_LENGTH_SYMBOLS)) {
+        return "Error, incomplete code length code.\n";
+    }
+    STATS(double start = thread_seconds());
+    bool built = huffman_table_build(&code_length_table, &s->arena, code_lengths, NUM_CODE_LENGTH_SYMBOLS, CODE_LENGTH_ROOT_BITS, NULL);
+    STATS(s->stats.table_seconds += thread_seconds() - start);
+    if (!built) {
+        return "Error, invalid code length code lengths.\n";
+    }
+    // build literal/length and distance tables
+    const char *error = process_dynamic_huffman_code_lengths(bs, &code_length_table, lit_len_dist_code_lengths, HLIT + HDIST);
+    if (error != NULL) {
+        return error;
+    }
+    if (s->strict && (lit_len_dist_code_lengths[END_OF_BLOCK] == 0 ||
+                      !huffman_code_complete(lit_len_dist_code_lengths, HLIT))) {
+        return "Error, incomplete literal/length code.\n";
+    }
+    STATS(start = thread_seconds());
+    built = huffman_table_build(&s->lit_len_storage, &s->arena, lit_len_dist_code_lengths, HLIT, LIT_LEN_ROOT_BITS, lit_len_values) &&
+            huffman_table_build(&s->dist_storage, &s->arena, lit_len_dist_code_lengths + HLIT, HDIST, DIST_ROOT_BITS, dist_values);
+    if (built) {
+        huffman_table_pair_literals(&s->lit_len_storage);
+    }
+    STATS(s->stats.table_seconds += thread_seconds() - start);
+    if (!built) {
+        return "Error, invalid literal/length or distance code lengths.\n";
+    }
+    s->lit_len_table = &s->lit_len_storage;
+    s->dist_table = &s->dist_storage;
+    return NULL;
 }
 
 // this is specified by RFC 1951 section 3.2.4
-static void nflate_uncompressed_block(bitstream *bs, uint8_t **output_buffer, size_t *output_buffer_length) {
+static const char *start_uncompressed_block(nflate_stream *s) {
+    bitstream *bs = &s->bs;
     bs_move_to_boundary(bs);
     // LEN and NLEN are two bytes each, NLEN is 1-complement of LEN
     uint16_t LEN = (uint16_t)bs_read_bits_rev(bs, 16);
     uint16_t NLEN = (uint16_t)bs_read_bits_rev(bs, 16);
     if ((LEN ^ NLEN) != 0xFFFF) {
-        fprintf(stderr, "LEN is not the one's complement of NLEN.\n");
-    }
-    // copy bytes over
-    // make room for them
-    size_t insert_location = 0;
-    if (*output_buffer == NULL) {
-        *output_buffer = realloc(*output_buffer, LEN);
-        *output_buffer_length = LEN;
-    } else {
-        insert_location = *output_buffer_length;
-        *output_buffer = realloc(*output_buffer, ((*output_buffer_length) + LEN));
-        *output_buffer_length = ((*output_buffer_length) + LEN);
+        return "LEN is not the one's complement of NLEN.\n";
     }
-    bs_read_bytes(bs, (*output_buffer) + insert_location, LEN);
+    s->stored_remaining = LEN;
+    return NULL;
 }
 
-// *compressed* is the DEFLATE compressed data to be inflated
-// *length* is the length of that data in bytes
-// *result_length* is a pointer to a place to hold the length of the uncompressed data in bytes
-// returns the uncompressed data as a byte pointer
-uint8_t *nflate(uint8_t *compressed, size_t length, size_t *result_length) {
-    uint8_t *reconstituted = NULL;
-    
-    bitstream *bs = create_bitstream(compressed, length);
-    
-    bool BFINAL; // name comes from RFC 1951
-    do {
-        // read block header
-        BFINAL = bs_read_bit(bs); // is this the last block?
-        uint64_t BTYPE = bs_read_bits_rev(bs, 2); // name comes from RFC 1951
-        
-        switch (BTYPE) {
-            case 0: // uncompressed
-                nflate_uncompressed_block(bs, &reconstituted, result_length);
+// copy as much of an uncompressed block as there is input and room for
+static nflate_status copy_uncompressed(nflate_stream *s) {
+    size_t available = (size_t)(bs_bits_left(&s->bs) / 8);
+    size_t room = s->output_size - s->output_pos;
+    size_t amount = s->stored_remaining;
+    if (amount > available) {
+        amount = available;
+    }
+    if (amount > room) {
+        amount = room;
+    }
+    bs_read_bytes(&s->bs, s->output + s->output_pos, amount);
+    s->output_pos += amount;
+    s->stored_remaining -= amount;
+    STATS(s->stats.stored_bytes += amount);
+    if (s->stored_remaining == 0) {
+        end_block(s);
+        return NFLATE_OK;
+    }
+    return (amount == available) ? NFLATE_NEEDS_INPUT : NFLATE_NEEDS_OUTPUT;
+}
+
+// read a block header along with any code length tables that follow it
+// if the input runs out part way through, nothing is consumed
+static nflate_status read_block_header(nflate_stream *s) {
+    bitstream *bs = &s->bs;
+    bitstream saved = *bs;
+    // time spent building tables is counted on its own
+    STATS(double start = thread_seconds() - s->stats.table_seconds);
+    s->BFINAL = bs_read_bit(bs); // is this the last block?
+    uint64_t BTYPE = bs_read_bits_rev(bs, 2); // name comes from RFC 1951
+
+    const char *error = NULL;
+    stream_state next_state = HUFFMAN_BLOCK;
+    switch (BTYPE) {
+        case 0: // uncompressed
+            error = start_uncompressed_block(s);
+            next_state = STORED_BLOCK;
+            break;
+        case 1: // fixed huffman codes
+            error = start_fixed_block(s);
+            break;
+        case 2: // dynamic huffman codes
+            error = start_dynamic_block(s);
+            break;
+        default: // reserved
+            error = "Error, improper block header.\n";
+            break;
+    }
+
+    STATS(s->stats.header_seconds += thread_seconds() - s->stats.table_seconds - start);
+    // errors only count if they weren't caused by reading past the end of the input
+    if (bs_overrun(bs)) {
+        reset_tables(s);
+        *bs = saved;
+        return NFLATE_NEEDS_INPUT;
+    }
+    if (error != NULL) {
+        reset_tables(s);
+        return fail(s, error);
+    }
+    s->state = next_state;
+    STATS(s->stats.blocks[BTYPE]++);
+    return NFLATE_OK;
+}
+
+// tell on_block where the block about to be read starts and what history it may refer back to
+static void report_block(nflate_stream *s) {
+    size_t window_length = (s->output_pos < WINDOW_SIZE) ? s->output_pos : WINDOW_SIZE;
+    uint64_t bit_position = s->input_dropped * 8 + bs_bit_position(&s->bs);
+    uint64_t uncompressed_position = s->output_dropped + s->output_pos - s->primed;
+    s->on_block(bit_position, uncompressed_position, s->output + s->output_pos - window_length, window_length, s->on_block_context);
+    s->block_reported = true;
+}
+
+// decode blocks until the end of the final block or until the input or room for output runs out
+static nflate_status decode_blocks(nflate_stream *s) {
+    for (;;) {
+        nflate_status status = NFLATE_OK;
+        switch (s->state) {
+            case BLOCK_HEADER:
+                if (bs_bit_position(&s->bs) >= s->stop_bit) {
+                    return NFLATE_DONE;
+                }
+                if (s->on_block != NULL && !s->block_reported) {
+                    report_block(s);
+                }
+                status = read_block_header(s);
+                if (status == NFLATE_OK) {
+                    s->block_reported = false;
+                }
                 break;
-            case 1: // fixed huffman codes
-            {
-                nflate_fixed_block(bs, &reconstituted, result_length);
-                
-//                printf("%s", reconstituted);
+            case STORED_BLOCK: {
+                STATS(double start = thread_seconds());
+                status = (s->markers != NULL) ? copy_uncompressed_markers(s) : copy_uncompressed(s);
+                STATS(s->stats.stored_seconds += thread_seconds() - start);
                 break;
             }
-            case 2: // dynamic huffman codes
-                nflate_dynamic_block(bs, &reconstituted, result_length);
-                
-//                printf("%s", reconstituted);
-                break;
-            case 3: // reserved
-                fprintf(stderr, "Error, improper block header.\n");
+            case HUFFMAN_BLOCK: {
+                STATS(double start = thread_seconds());
+                status = (s->markers != NULL) ? expand_markers(s) : expand(s);
+                STATS(s->stats.huffman_seconds += thread_seconds() - start);
                 break;
+            }
+            case STREAM_DONE:
+                return NFLATE_DONE;
+            case STREAM_ERROR:
+                return NFLATE_DATA_ERROR;
+        }
+        if (status != NFLATE_OK) {
+            return status;
+        }
+    }
+}
+
+// inflate blocks until the end of the final block or until the input or room for output runs out
+// when computing a CRC, output is produced in chunks that are checksummed right
+// after they are written rather than in a second pass over all of it
+static nflate_status inflate_blocks(nflate_stream *s) {
+    if (!s->compute_crc) {
+        return decode_blocks(s);
+    }
+    for (;;) {
+        size_t output_size = s->output_size;
+        size_t start = s->output_pos;
+        bool limited = (output_size - start) > CRC_CHUNK_SIZE;
+        if (limited) {
+            s->output_size = start + CRC_CHUNK_SIZE;
+        }
+        nflate_status status = decode_blocks(s);
+        s->output_size = output_size;
+        STATS(double crc_start = thread_seconds());
+        s->crc = crc32_update(s->crc, s->output + start, s->output_pos - start);
+        STATS(s->stats.crc_seconds += thread_seconds() - crc_start);
+        // running into the end of the chunk isn't running out of room
+        if (status != NFLATE_NEEDS_OUTPUT || !limited) {
+            return status;
+        }
+    }
+}
+
+// set up *s* to inflate all of *compressed* at once into a flat output buffer
+static void init_one_shot(nflate_stream *s, uint8_t *compressed, size_t length, bool compute_crc) {
+    memset(s, 0, sizeof(nflate_stream));
+    s->state = BLOCK_HEADER;
+    s->bs.data = compressed;
+    s->bs.byteLength = length;
+    s->compute_crc = compute_crc;
+    s->crc = crc32_init();
+    s->stop_bit = UINT64_MAX;
+}
+
+// number of bytes of compressed data up to and including the one holding the last bit read
+static size_t bytes_consumed(const nflate_stream *s) {
+    return (size_t)((bs_bit_position(&s->bs) + 7) / 8);
+}
+
+// inflate all of the data *s* was set up with into an output buffer that
+// starts out *initial_size* bytes big and doubles whenever it runs out of room
+// the *window_length* bytes of *window* go at the front of the buffer as history
+// for back-references and are taken off again at the end
+static uint8_t *inflate_growing(nflate_stream *s, size_t initial_size, const uint8_t *window, size_t window_length,
+                                size_t *result_length, size_t *consumed, uint32_t *crc) {
+    s->output_size = ((initial_size > 0) ? initial_size : 1) + window_length;
+    s->output = malloc(s->output_size);
+    *result_length = 0;
+    if (s->output == NULL) {
+        fprintf(stderr, "Error allocating memory for output.\n");
+        return NULL;
+    }
+    if (window_length > 0) {
+        memcpy(s->output, window, window_length);
+    }
+    s->output_pos = window_length;
+
+    nflate_status status;
+    while ((status = inflate_blocks(s)) == NFLATE_NEEDS_OUTPUT) {
+        s->output_size *= 2;
+        uint8_t *grown = realloc(s->output, s->output_size);
+        if (grown == NULL) {
+            fprintf(stderr, "Error allocating memory for output.\n");
+            status = NFLATE_MEMORY_ERROR;
+            break;
+        }
+        s->output = grown;
+    }
+    free_tables(s);
+    STATS(add_to_totals(s));
+
+    if (status != NFLATE_DONE) {
+        if (status == NFLATE_NEEDS_INPUT && !s->quiet) {
+            fprintf(stderr, "Error, compressed data ended before the final block.\n");
+        }
+        free(s->output);
+        return NULL;
+    }
+
+    // get rid of the window and excess
+    *result_length = s->output_pos - window_length;
+    if (window_length > 0) {
+        memmove(s->output, s->output + window_length, *result_length);
+    }
+    if (consumed != NULL) {
+        *consumed = bytes_consumed(s);
+    }
+    if (crc != NULL) {
+        *crc = crc32_final(s->crc);
+    }
+    uint8_t *shrunk = realloc(s->output, (*result_length > 0) ? *result_length : 1);
+    return (shrunk != NULL) ? shrunk : s->output;
+}
+
+// *compressed* is the DEFLATE compressed data to be inflated
+// *length* is the length of that data in bytes
+// *result_length* is a pointer to a place to hold the length of the uncompressed data in bytes
+// *crc* is a pointer to a place to hold the CRC-32 of the uncompressed data, or NULL to skip computing it
+// returns the uncompressed data as a byte pointer, or NULL if the data could not be inflated
+uint8_t *nflate(uint8_t *compressed, size_t length, size_t *result_length, uint32_t *crc) {
+    nflate_stream s;
+    init_one_shot(&s, compressed, length, crc != NULL);
+    return inflate_growing(&s, WINDOW_SIZE, NULL, 0, result_length, NULL, crc);
+}
+
+uint8_t *nflate_member(uint8_t *compressed, size_t length, size_t size_hint, size_t *result_length, size_t *consumed, uint32_t *crc) {
+    nflate_stream s;
+    init_one_shot(&s, compressed, length, crc != NULL);
+    s.quiet = true;
+    return inflate_growing(&s, (size_hint > 0) ? size_hint : WINDOW_SIZE, NULL, 0, result_length, consumed, crc);
+}
+
+uint8_t *nflate_with_dictionary(uint8_t *compressed, size_t length, const uint8_t *dictionary, size_t dictionary_length,
+                                size_t size_hint, size_t *result_length, size_t *consumed) {
+    if (dictionary_length > WINDOW_SIZE) {
+        dictionary += dictionary_length - WINDOW_SIZE;
+        dictionary_length = WINDOW_SIZE;
+    }
+    nflate_stream s;
+    init_one_shot(&s, compressed, length, false);
+    s.quiet = true;
+    return inflate_growing(&s, (size_hint > 0) ? size_hint : WINDOW_SIZE, dictionary, dictionary_length, result_length, consumed, NULL);
+}
+
+// inflate all of the data *s* was set up with straight into *dest*
+static nflate_status inflate_into(nflate_stream *s, uint8_t *dest, size_t capacity, size_t *result_length, size_t *consumed, uint32_t *crc) {
+    s->output = dest;
+    s->output_size = capacity;
+    nflate_status status = inflate_blocks(s);
+    if (status == NFLATE_NEEDS_INPUT && !s->quiet) {
+        fprintf(stderr, "Error, compressed data ended before the final block.\n");
+    }
+    *result_length = s->output_pos;
+    if (consumed != NULL) {
+        *consumed = bytes_consumed(s);
+    }
+    if (crc != NULL) {
+        *crc = crc32_final(s->crc);
+    }
+    return status;
+}
+
+nflate_status nflate_into(uint8_t *compressed, size_t length, uint8_t *dest, size_t capacity, size_t *result_length, size_t *consumed, uint32_t *crc) {
+    nflate_stream s;
+    init_one_shot(&s, compressed, length, crc != NULL);
+    nflate_status status = inflate_into(&s, dest, capacity, result_length, consumed, crc);
+    free_tables(&s);
+    STATS(add_to_totals(&s));
+    return status;
+}
+
+// all a context needs to hold on to between calls is the storage for tables
+struct nflate_context {
+    huffman_arena arena;
+};
+
+nflate_context *nflate_context_create(void) {
+    return calloc(1, sizeof(nflate_context));
+}
+
+nflate_status nflate_context_into(nflate_context *context, uint8_t *compressed, size_t length, uint8_t *dest, size_t capacity,
+                                  size_t *result_length, size_t *consumed, uint32_t *crc) {
+    nflate_stream s;
+    init_one_shot(&s, compressed, length, crc != NULL);
+    s.quiet = true;
+    s.arena = context->arena;
+    nflate_status status = inflate_into(&s, dest, capacity, result_length, consumed, crc);
+    reset_tables(&s);
+    STATS(add_to_totals(&s));
+    context->arena = s.arena; // it may have been set up during this call
+    return status;
+}
+
+void nflate_context_free(nflate_context *context) {
+    if (context == NULL) {
+        return;
+    }
+    huffman_arena_free(&context->arena);
+    free(context);
+}
+
+// the 64 bits of *data* starting *bit* bits in, with zeros past the end
+// only the low 57 are guaranteed to come from the data
+static uint64_t peek_bits_at(const uint8_t *data, size_t length, uint64_t bit) {
+    size_t index = (size_t)(bit / 8);
+    uint64_t word = 0;
+    if (index + 8 <= length) {
+        for (int i = 0; i < 8; i++) {
+            word |= (uint64_t)data[index + i] << (8 * i);
+        }
+    } else {
+        for (size_t i = 0; index + i < length; i++) {
+            word |= (uint64_t)data[index + i] << (8 * i);
+        }
+    }
+    return word >> (bit % 8);
+}
+
+// do the *count* 3 bit code length code lengths at the bottom of *bits* make up a complete code?
+// the order they are assigned to symbols in doesn't change that
+static bool code_length_code_complete(uint64_t bits, int count) {
+    int space = 0;
+    for (int i = 0; i < count; i++) {
+        int code_length = (int)((bits >> (3 * i)) & 7);
+        if (code_length > 0) {
+            space += 1 << (7 - code_length);
+        }
+    }
+    return space == 128;
+}
+
+// could a non-final stored block start at *bit*? its padding must be zero and
+// LEN and NLEN must be complements
+static bool stored_header_plausible(const uint8_t *data, size_t length, uint64_t bit, uint64_t bits) {
+    int padding = (int)((8 - (bit + 3) % 8) % 8);
+    if ((bits >> 3) & ((1u << padding) - 1)) {
+        return false;
+    }
+    size_t index = (size_t)((bit + 3 + 7) / 8);
+    if (length < 4 || index > length - 4) {
+        return false;
+    }
+    return (data[index] ^ data[index + 2]) == 0xFF && (data[index + 1] ^ data[index + 3]) == 0xFF;
+}
+
+bool nflate_find_block(uint8_t *compressed, size_t length, uint64_t start_bit, uint64_t end_bit, uint64_t *found) {
+    nflate_stream s;
+    init_one_shot(&s, compressed, length, false);
+    s.quiet = true;
+    s.strict = true;
+    if (end_bit > (uint64_t)length * 8) {
+        end_bit = (uint64_t)length * 8;
+    }
+    for (uint64_t bit = start_bit; bit < end_bit; bit++) {
+        // cheap checks on the bits at the start of the header rule out almost every position
+        uint64_t bits = peek_bits_at(compressed, length, bit);
+        if ((bits & 7) == 4) { // BFINAL 0, BTYPE 2
+            if (((bits >> 3) & 31) > 29 || ((bits >> 8) & 31) > 29) {
+                continue;
+            }
+            int HCLEN = (int)((bits >> 13) & 15) + 4;
+            if (!code_length_code_complete(peek_bits_at(compressed, length, bit + 17), HCLEN)) {
+                continue;
+            }
+        } else if ((bits & 7) == 0) { // BFINAL 0, BTYPE 0
+            if (!stored_header_plausible(compressed, length, bit, bits)) {
+                continue;
+            }
+        } else {
+            continue;
+        }
+        // then the whole header has to read as a valid one; these tries
+        // aren't real blocks, so they are left out of the statistics
+        bs_seek(&s.bs, bit);
+        s.state = BLOCK_HEADER;
+        nflate_status status = read_block_header(&s);
+        reset_tables(&s);
+        if (status == NFLATE_OK) {
+            free_tables(&s);
+            *found = bit;
+            return true;
+        }
+    }
+    free_tables(&s);
+    return false;
+}
+
+nflate_status nflate_decode_chunk(uint8_t *compressed, size_t length, uint64_t start_bit, uint64_t stop_bit, nflate_chunk *chunk) {
+    memset(chunk, 0, sizeof(nflate_chunk));
+    nflate_stream s;
+    init_one_shot(&s, compressed, length, false);
+    s.quiet = true;
+    s.stop_bit = stop_bit;
+    bs_seek(&s.bs, start_bit);
+
+    // start with room for a typical compression ratio and grow from there
+    uint64_t end_bit = (stop_bit < (uint64_t)length * 8) ? stop_bit : (uint64_t)length * 8;
+    s.output_size = (size_t)((end_bit > start_bit) ? (end_bit - start_bit) / 2 : 0) + WINDOW_SIZE;
+    s.markers = malloc(s.output_size * sizeof(uint16_t));
+    if (s.markers == NULL) {
+        return NFLATE_MEMORY_ERROR;
+    }
+    nflate_status status;
+    while ((status = decode_blocks(&s)) == NFLATE_NEEDS_OUTPUT) {
+        s.output_size *= 2;
+        uint16_t *grown = realloc(s.markers, s.output_size * sizeof(uint16_t));
+        if (grown == NULL) {
+            status = NFLATE_MEMORY_ERROR;
+            break;
+        }
+        s.markers = grown;
+    }
+    free_tables(&s);
+    STATS(add_to_totals(&s));
+    if (status != NFLATE_DONE) {
+        free(s.markers);
+        return status;
+    }
+    chunk->output = s.markers;
+    chunk->output_length = s.output_pos;
+    chunk->start_bit = start_bit;
+    chunk->end_bit = bs_bit_position(&s.bs);
+    chunk->final = (s.state == STREAM_DONE);
+    return NFLATE_DONE;
+}
+
+nflate_stream *nflate_stream_init(void) {
+    nflate_stream *s = calloc(1, sizeof(nflate_stream));
+    if (s == NULL) {
+        return NULL;
+    }
+    s->state = BLOCK_HEADER;
+    s->compute_crc = true;
+    s->crc = crc32_init();
+    s->stop_bit = UINT64_MAX;
+    s->input = malloc(STREAM_INPUT_SIZE);
+    s->output = malloc(STREAM_OUTPUT_SIZE);
+    if (s->input == NULL || s->output == NULL) {
+        nflate_stream_end(s);
+        return NULL;
+    }
+    s->output_size = STREAM_OUTPUT_SIZE;
+    s->bs.data = s->input;
+    return s;
+}
+
+size_t nflate_stream_feed(nflate_stream *s, const uint8_t *input, size_t length) {
+    // drop the input that has already been consumed, keeping any partial byte
+    uint64_t position = bs_bit_position(&s->bs);
+    size_t consumed = (size_t)(position / 8);
+    size_t kept = s->bs.byteLength - consumed;
+    memmove(s->input, s->input + consumed, kept);
+    s->input_dropped += consumed;
+
+    size_t accepted = STREAM_INPUT_SIZE - kept;
+    if (accepted > length) {
+        accepted = length;
+    }
+    memcpy(s->input + kept, input, accepted);
+    s->bs.byteLength = kept + accepted;
+    bs_seek(&s->bs, position % 8);
+    return accepted;
+}
+
+nflate_status nflate_stream_drain(nflate_stream *s, uint8_t *output, size_t capacity, size_t *produced) {
+    *produced = 0;
+    for (;;) {
+        // hand over whatever has been decoded
+        size_t pending = s->output_pos - s->drain_pos;
+        if (pending > capacity - *produced) {
+            pending = capacity - *produced;
+        }
+        memcpy(output + *produced, s->output + s->drain_pos, pending);
+        s->drain_pos += pending;
+        *produced += pending;
+        if (s->drain_pos < s->output_pos) {
+            return NFLATE_OK; // *output* is full
+        }
+
+        // everything has been handed over, so only the last 32 KB are still needed as history
+        if ((s->output_size - s->output_pos) < WINDOW_SIZE && s->output_pos > WINDOW_SIZE) {
+            memmove(s->output, s->output + s->output_pos - WINDOW_SIZE, WINDOW_SIZE);
+            s->output_dropped += s->output_pos - WINDOW_SIZE;
+            s->output_pos = WINDOW_SIZE;
+            s->drain_pos = WINDOW_SIZE;
+        }
+
+        size_t before = s->output_pos;
+        nflate_status status = inflate_blocks(s);
+        if (status == NFLATE_DATA_ERROR || status == NFLATE_MEMORY_ERROR) {
+            return status;
         }
-        
-    } while(BFINAL != true);
-    
-    return reconstituted;
+        if (s->output_pos == before) {
+            return status; // NFLATE_DONE or NFLATE_NEEDS_INPUT with nothing left to hand over
+        }
+    }
+}
+
+void nflate_stream_prime(nflate_stream *s, int skip_bits, const uint8_t *window, size_t window_length) {
+    if (window_length > WINDOW_SIZE) {
+        window += window_length - WINDOW_SIZE;
+        window_length = WINDOW_SIZE;
+    }
+    if (window_length > 0) {
+        memcpy(s->output, window, window_length);
+    }
+    s->output_pos = window_length;
+    s->drain_pos = window_length;
+    s->primed = window_length;
+    bs_seek(&s->bs, (uint64_t)skip_bits);
+}
+
+void nflate_stream_on_block(nflate_stream *s, nflate_block_callback on_block, void *context) {
+    s->on_block = on_block;
+    s->on_block_context = context;
+}
+
+size_t nflate_stream_unused_input(nflate_stream *s, const uint8_t **unused) {
+    size_t consumed = (size_t)((bs_bit_position(&s->bs) + 7) / 8);
+    if (consumed > s->bs.byteLength) {
+        consumed = s->bs.byteLength;
+    }
+    if (unused != NULL) {
+        *unused = s->input + consumed;
+    }
+    return s->bs.byteLength - consumed;
+}
+
+uint32_t nflate_stream_crc32(nflate_stream *s) {
+    return crc32_final(s->crc);
+}
+
+void nflate_stream_end(nflate_stream *s) {
+    if (s == NULL) {
+        return;
+    }
+    free_tables(s);
+    STATS(add_to_totals(s));
+    free(s->input);
+    free(s->output);
+    free(s);
 }
@@ -21,14 +21,192 @@
 
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdbool.h>
 
 // Based on RFC 1951
 // https://tools.ietf.org/html/rfc1951
 
+typedef enum {
+    NFLATE_OK, // progress was made, call again
+    NFLATE_DONE, // the final block has been decoded and all of its output handed out
+    NFLATE_NEEDS_INPUT, // all decoded output has been handed out and more compressed data is needed
+    NFLATE_NEEDS_OUTPUT, // there is no room left for the decoded data
+    NFLATE_DATA_ERROR, // the compressed data is invalid
+    NFLATE_MEMORY_ERROR // an allocation failed
+} nflate_status;
+
 // *compressed* is the DEFLATE compressed data to be inflated
 // *length* is the length of that data in bytes
 // *result_length* is a pointer to a place to hold the length of the uncompressed data in bytes
-// returns the uncompressed data as a byte pointer
-uint8_t *nflate(uint8_t *compressed, size_t length, size_t *result_length);
+// *crc* is a pointer to a place to hold the CRC-32 of the uncompressed data, or NULL to skip computing it;
+// the CRC is computed piece by piece as the data is inflated, while it is still in cache
+// returns the uncompressed data as a byte pointer, or NULL if the data could not be inflated
+uint8_t *nflate(uint8_t *compressed, size_t length, size_t *result_length, uint32_t *crc);
+
+// inflate the DEFLATE data at the start of *compressed*, which may be followed
+// by other data such as a gzip trailer and the members after it
+// *size_hint* is a guess at the uncompressed size to allocate up front, or 0
+// *consumed* is a pointer to a place to hold how many bytes the DEFLATE data took up
+// nothing is printed if the data is invalid, so this can be used to try out
+// data that only might be the start of a DEFLATE stream
+// otherwise works like nflate()
+uint8_t *nflate_member(uint8_t *compressed, size_t length, size_t size_hint, size_t *result_length, size_t *consumed, uint32_t *crc);
+
+// inflate the DEFLATE data at the start of *compressed* as if the
+// *dictionary_length* bytes of *dictionary* had come right before its output,
+// so back-references may reach into them, as with a zlib preset dictionary
+// (RFC 1950 FDICT); only the last 32 KB of the dictionary can be referred to
+// the dictionary isn't part of the result, and no CRC-32 is computed
+// otherwise works like nflate_member()
+uint8_t *nflate_with_dictionary(uint8_t *compressed, size_t length, const uint8_t *dictionary, size_t dictionary_length,
+                                size_t size_hint, size_t *result_length, size_t *consumed);
+
+// inflate *compressed* straight into a buffer the caller provides, with no allocation or copying
+// *dest* is the buffer and *capacity* is how many bytes it has room for
+// *result_length* is a pointer to a place to hold how many bytes were written
+// *consumed* is a pointer to a place to hold how many bytes of *compressed* were
+// used, or NULL; anything after the final block is left alone
+// *crc* is a pointer to a place to hold the CRC-32 of the bytes written, or NULL to skip computing it
+// returns NFLATE_DONE on success, NFLATE_NEEDS_OUTPUT if the uncompressed
+// data doesn't fit in *capacity* bytes, NFLATE_NEEDS_INPUT if the compressed
+// data ends before the final block, or NFLATE_DATA_ERROR
+nflate_status nflate_into(uint8_t *compressed, size_t length, uint8_t *dest, size_t capacity, size_t *result_length, size_t *consumed, uint32_t *crc);
+
+// Reusable contexts
+// For inflating lots of small pieces of data one after another: a context
+// keeps the storage for decode tables from one call to the next, so after the
+// first call nothing is allocated at all. A context may only be used by one
+// thread at a time.
+typedef struct nflate_context nflate_context;
+
+// returns a new context, or NULL if out of memory
+nflate_context *nflate_context_create(void);
+
+// works like nflate_into() using the storage held by *context*, except that
+// nothing is printed if the data is invalid
+nflate_status nflate_context_into(nflate_context *context, uint8_t *compressed, size_t length, uint8_t *dest, size_t capacity,
+                                  size_t *result_length, size_t *consumed, uint32_t *crc);
+
+// free the context and everything it holds
+void nflate_context_free(nflate_context *context);
+
+// Speculative decoding
+// Lets a long DEFLATE stream be split into chunks that are decoded at the same
+// time. A chunk starting in the middle of the data can't know the 32 KB of
+// output that came before it, so its output is 16 bit values: a byte below
+// NFLATE_MARKER_BASE, or a marker standing for the byte at position
+// (value - NFLATE_MARKER_BASE) of that 32 KB window, oldest first, to be
+// filled in once the chunk before it has been decoded.
+#define NFLATE_MARKER_BASE 256
+
+typedef struct {
+    uint16_t *output; // bytes and markers, to be freed by the caller
+    size_t output_length;
+    uint64_t start_bit; // bit position of the first block of the chunk
+    uint64_t end_bit; // bit position right after the last block of the chunk
+    bool final; // the last block of the chunk was the final one
+} nflate_chunk;
+
+// look for a block that could start at a bit position from *start_bit* up to
+// but not including *end_bit* of *compressed*, by trying to read a header there
+// only non-final dynamic and stored blocks are looked for, and only dynamic
+// blocks whose codes are complete, as every common encoder writes them
+// *found* is a pointer to a place to hold the bit position of the block
+// returns false if there isn't one; a block found may still be a false
+// positive that only fails once its symbols are decoded
+bool nflate_find_block(uint8_t *compressed, size_t length, uint64_t start_bit, uint64_t end_bit, uint64_t *found);
+
+// decode blocks of *compressed* starting with the one at *start_bit* and
+// stopping before the first one that starts at or after *stop_bit*, or after
+// the final block, into *chunk*
+// nothing is printed if the data is invalid
+// returns NFLATE_DONE on success, NFLATE_NEEDS_INPUT if the data ends in the
+// middle of a block, or an error
+nflate_status nflate_decode_chunk(uint8_t *compressed, size_t length, uint64_t start_bit, uint64_t stop_bit, nflate_chunk *chunk);
+
+// Streaming interface
+// Inflates DEFLATE data that arrives in pieces while only holding on to the
+// 32 KB window plus small input and output buffers. A block can be suspended
+// anywhere when either the input or room for output runs out.
+//
+//  nflate_stream *s = nflate_stream_init();
+//  while there is compressed data:
+//      feed it with nflate_stream_feed() until all of it is accepted,
+//      calling nflate_stream_drain() whenever the stream stops accepting input
+//  call nflate_stream_drain() until it returns NFLATE_DONE
+//  nflate_stream_end(s);
+typedef struct nflate_stream nflate_stream;
+
+// returns a new stream ready for the start of DEFLATE data, or NULL if out of memory
+nflate_stream *nflate_stream_init(void);
+
+// hand the stream the next *length* bytes of compressed data
+// returns how many bytes were taken; once the input buffer is full it takes
+// none until some output has been drained
+size_t nflate_stream_feed(nflate_stream *s, const uint8_t *input, size_t length);
+
+// inflate as much of the data fed so far as possible, copying up to *capacity*
+// bytes of output to *output* and storing the number copied in *produced*
+// returns NFLATE_OK when *output* was filled, NFLATE_NEEDS_INPUT when
+// everything fed so far has been inflated and drained, NFLATE_DONE at the end
+// of the final block, or an error
+nflate_status nflate_stream_drain(nflate_stream *s, uint8_t *output, size_t capacity, size_t *produced);
+
+// start the stream in the middle of DEFLATE data, at a block boundary *skip_bits*
+// bits into the first byte that will be fed, as if the last *window_length*
+// bytes of output so far had been *window*; the window itself isn't handed out
+// must be called before anything is fed
+void nflate_stream_prime(nflate_stream *s, int skip_bits, const uint8_t *window, size_t window_length);
+
+// called at the start of every block with the position of its first bit
+// counting from the first bit fed, how much output came before it (not
+// counting a primed window), and the up to 32 KB of output right before it
+typedef void (*nflate_block_callback)(uint64_t bit_position, uint64_t uncompressed_position, const uint8_t *window, size_t window_length, void *context);
+
+// have *on_block* called along with *context* at the start of every block from now on
+void nflate_stream_on_block(nflate_stream *s, nflate_block_callback on_block, void *context);
+
+// number of bytes fed to the stream that it hasn't used; once it is done,
+// this is how much of the input came after the end of the DEFLATE data
+// *unused* is a pointer to a place to hold where those bytes are, or NULL;
+// they stay there until the stream is fed again or ended
+size_t nflate_stream_unused_input(nflate_stream *s, const uint8_t **unused);
+
+// CRC-32 of all of the output the stream has produced so far
+uint32_t nflate_stream_crc32(nflate_stream *s);
+
+// free the stream and everything it holds
+void nflate_stream_end(nflate_stream *s);
+
+#ifdef NFLATE_STATS
+// Statistics
+// Built with NFLATE_STATS defined (make stats), every decompression, however
+// it was started, adds what it saw to totals for the whole process when it
+// ends. Without it none of this exists and nothing is counted.
+#define NFLATE_STATS_LENGTH_BUCKETS 9 // lengths 3 to 258
+#define NFLATE_STATS_DISTANCE_BUCKETS 16 // distances 1 to 32768
+
+typedef struct {
+    uint64_t blocks[3]; // by BTYPE: stored, fixed and dynamic
+    uint64_t literals;
+    uint64_t matches;
+    uint64_t match_bytes; // bytes copied from back-references
+    uint64_t stored_bytes; // bytes copied out of stored blocks
+    uint64_t length_histogram[NFLATE_STATS_LENGTH_BUCKETS]; // matches with a length from 2^i up to 2^(i+1)
+    uint64_t distance_histogram[NFLATE_STATS_DISTANCE_BUCKETS]; // matches with a distance from 2^i up to 2^(i+1)
+    double header_seconds; // reading block headers and code lengths
+    double table_seconds; // building Huffman tables for dynamic blocks
+    double huffman_seconds; // decoding the symbols of fixed and dynamic blocks
+    double stored_seconds; // copying stored blocks
+    double crc_seconds; // checksumming output
+} nflate_stats;
+
+// copy the totals so far into *stats*
+void nflate_stats_get(nflate_stats *stats);
+
+// start counting from zero again
+void nflate_stats_reset(void);
+#endif
+
 
 #endif /* nflate_h */
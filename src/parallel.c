@@ -0,0 +1,233 @@
+//
+//  parallel.c
+//  nflate
+//
+//  Copyright (c) 2020 David Kopec
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "parallel.h"
+#include "nflate.h"
+#include "crc32.h"
+
+#define WINDOW_SIZE 32768
+
+// The data is cut into chunks of PARALLEL_CHUNK_SIZE bytes. Block boundaries
+// don't line up with the cuts, so each worker looks for the first block header
+// after the start of its chunk and decodes from there up to the first block
+// that starts after the end of its chunk, leaving markers wherever the output
+// refers back to the window before it. The main thread then walks the chain of
+// chunks: a chunk is only used if it starts exactly where the one before it
+// ended, otherwise (a false positive, or a fixed block the search can't see)
+// that stretch is decoded again from the right place. Markers are filled in
+// from the window of the chunk before, and the output is checksummed and
+// written strictly in order.
+typedef struct {
+    uint8_t *compressed;
+    size_t length;
+    uint64_t start_bit; // where to start looking for a block
+    uint64_t end_bit; // decode up to the first block that starts at or after this bit
+    bool exact; // start_bit is known to be the start of a block
+    threadpool_task *task; // NULL if it isn't running on the pool
+
+    // filled in by decode_chunk()
+    nflate_status status;
+    nflate_chunk chunk;
+} chunk_task;
+
+static void decode_chunk(void *argument) {
+    chunk_task *t = argument;
+    if (t->exact) {
+        t->status = nflate_decode_chunk(t->compressed, t->length, t->start_bit, t->end_bit, &t->chunk);
+        return;
+    }
+    // most positions that pass for a block header fail within a few symbols
+    uint64_t bit = t->start_bit;
+    uint64_t found;
+    while (nflate_find_block(t->compressed, t->length, bit, t->end_bit, &found)) {
+        t->status = nflate_decode_chunk(t->compressed, t->length, found, t->end_bit, &t->chunk);
+        if (t->status == NFLATE_DONE || t->status == NFLATE_MEMORY_ERROR) {
+            return;
+        }
+        bit = found + 1;
+    }
+    t->status = NFLATE_DATA_ERROR;
+}
+
+// the header of a stored block is zero bits up to a byte boundary, so the
+// search may find it a bit or two early or late; is a block starting at either
+// *a* or *b* the same stored block?
+static bool same_stored_block(const uint8_t *compressed, uint64_t a, uint64_t b) {
+    if (b < a) {
+        uint64_t swap = a;
+        a = b;
+        b = swap;
+    }
+    uint64_t boundary = (a + 3 + 7) / 8 * 8;
+    if ((b + 3 + 7) / 8 * 8 != boundary) {
+        return false;
+    }
+    for (uint64_t bit = a; bit < boundary; bit++) {
+        if ((compressed[bit / 8] >> (bit % 8)) & 1) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// fill in the markers of *chunk* from *window*, the last *window_length* bytes
+// of which are the output before it, narrowing it to bytes in place
+// returns false if a marker refers to before the start of the data
+static bool resolve_markers(nflate_chunk *chunk, const uint8_t *window, size_t window_length) {
+    // byte i of the narrowed output never overlaps a value that hasn't been read yet
+    uint8_t *bytes = (uint8_t *)chunk->output;
+    size_t first_known = WINDOW_SIZE - window_length;
+    for (size_t i = 0; i < chunk->output_length; i++) {
+        uint16_t value = chunk->output[i];
+        if (value < NFLATE_MARKER_BASE) {
+            bytes[i] = (uint8_t)value;
+        } else {
+            size_t position = value - NFLATE_MARKER_BASE;
+            if (position < first_known) {
+                return false;
+            }
+            bytes[i] = window[position];
+        }
+    }
+    return true;
+}
+
+// slide *length* bytes of new output into the end of *window*
+static void update_window(uint8_t *window, size_t *window_length, const uint8_t *output, size_t length) {
+    if (length >= WINDOW_SIZE) {
+        memcpy(window, output + length - WINDOW_SIZE, WINDOW_SIZE);
+        *window_length = WINDOW_SIZE;
+        return;
+    }
+    memmove(window, window + length, WINDOW_SIZE - length);
+    memcpy(window + WINDOW_SIZE - length, output, length);
+    *window_length = (*window_length + length < WINDOW_SIZE) ? *window_length + length : WINDOW_SIZE;
+}
+
+bool parallel_inflate(threadpool *pool, int max_chunks, uint8_t *compressed, size_t length, members_writer write, void *context,
+                      size_t *consumed, uint64_t *output_length, uint32_t *crc) {
+    *consumed = 0;
+    *output_length = 0;
+    // chunks in flight, in order, as a ring
+    chunk_task *tasks = calloc(max_chunks, sizeof(chunk_task));
+    uint8_t *window = malloc(WINDOW_SIZE);
+    if (tasks == NULL || window == NULL) {
+        fprintf(stderr, "Error allocating memory for chunks.\n");
+        free(tasks);
+        free(window);
+        return false;
+    }
+    int first = 0;
+    int count = 0;
+
+    size_t num_chunks = (length + PARALLEL_CHUNK_SIZE - 1) / PARALLEL_CHUNK_SIZE;
+    size_t submitted = 0;
+    size_t window_length = 0;
+    uint32_t running_crc = crc32_init();
+    uint64_t next_block = 0; // bit position where the chunk after the last one used has to start
+    bool success = true;
+    bool done = false;
+    while (!done) {
+        // keep the pool busy with the chunks that come next
+        while (count < max_chunks && submitted < num_chunks) {
+            chunk_task *t = &tasks[(first + count) % max_chunks];
+            memset(t, 0, sizeof(chunk_task));
+            t->compressed = compressed;
+            t->length = length;
+            t->start_bit = (uint64_t)submitted * PARALLEL_CHUNK_SIZE * 8;
+            // the last chunk runs to the end of the stream, wherever that is
+            t->end_bit = (submitted + 1 < num_chunks) ? t->start_bit + (uint64_t)PARALLEL_CHUNK_SIZE * 8 : UINT64_MAX;
+            t->exact = (submitted == 0);
+            t->task = threadpool_submit(pool, decode_chunk, t);
+            if (t->task == NULL) {
+                decode_chunk(t); // do it here instead
+            }
+            count++;
+            submitted++;
+        }
+        if (count == 0) {
+            break; // the data ended before the final block
+        }
+
+        chunk_task *t = &tasks[first];
+        if (t->task != NULL) {
+            threadpool_join(pool, t->task);
+            t->task = NULL;
+        }
+        first = (first + 1) % max_chunks;
+        count--;
+
+        // the chunk before ran over all of this one
+        if (next_block >= t->end_bit) {
+            free(t->chunk.output);
+            continue;
+        }
+        // a guess that didn't start where the chunk before ended is no use
+        if (t->status != NFLATE_DONE ||
+            (t->chunk.start_bit != next_block && !same_stored_block(compressed, t->chunk.start_bit, next_block))) {
+            free(t->chunk.output);
+            t->status = nflate_decode_chunk(compressed, length, next_block, t->end_bit, &t->chunk);
+            if (t->status == NFLATE_MEMORY_ERROR) {
+                fprintf(stderr, "Error allocating memory for output.\n");
+                success = false;
+            }
+            if (t->status != NFLATE_DONE) {
+                break;
+            }
+        }
+
+        bool resolved = resolve_markers(&t->chunk, window, window_length);
+        uint8_t *output = (uint8_t *)t->chunk.output;
+        size_t chunk_length = t->chunk.output_length;
+        if (resolved) {
+            running_crc = crc32_update(running_crc, output, chunk_length);
+            *output_length += chunk_length;
+            if (chunk_length > 0 && !write(output, chunk_length, context)) {
+                success = false;
+            }
+            update_window(window, &window_length, output, chunk_length);
+            next_block = t->chunk.end_bit;
+            done = t->chunk.final;
+        }
+        free(t->chunk.output);
+        if (!resolved || !success) {
+            break;
+        }
+    }
+
+    // wait for chunks that are still being decoded
+    while (count > 0) {
+        chunk_task *t = &tasks[first];
+        if (t->task != NULL) {
+            threadpool_join(pool, t->task);
+        }
+        free(t->chunk.output);
+        first = (first + 1) % max_chunks;
+        count--;
+    }
+    if (done) {
+        *consumed = (size_t)((next_block + 7) / 8);
+        *crc = crc32_final(running_crc);
+    }
+    free(tasks);
+    free(window);
+    return success;
+}
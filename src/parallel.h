@@ -0,0 +1,45 @@
+//
+//  parallel.h
+//  nflate
+//
+//  Copyright (c) 2020 David Kopec
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+// Inflating a single long DEFLATE stream on several threads by splitting it
+// into chunks that are decoded speculatively, in the spirit of pugz and rapidgzip
+
+#ifndef parallel_h
+#define parallel_h
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "members.h"
+#include "threadpool.h"
+
+#define PARALLEL_CHUNK_SIZE (2 * 1024 * 1024) // bytes of compressed data per chunk
+#define PARALLEL_MIN_LENGTH (4 * PARALLEL_CHUNK_SIZE) // shorter streams aren't worth splitting up
+
+// inflate the DEFLATE data at the start of *compressed*, which may be followed
+// by other data, as chunks decoded on *pool* with up to *max_chunks* of them
+// in flight at once, handing the output to *write* along with *context* in order
+// *consumed* is a pointer to a place to hold how many bytes the DEFLATE data
+// took up, which is 0 if it couldn't be inflated
+// *output_length* and *crc* are pointers to places to hold the length and the
+// CRC-32 of the output
+// returns false if *write* failed or memory ran out
+bool parallel_inflate(threadpool *pool, int max_chunks, uint8_t *compressed, size_t length, members_writer write, void *context,
+                      size_t *consumed, uint64_t *output_length, uint32_t *crc);
+
+#endif /* parallel_h */
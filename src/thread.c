@@ -0,0 +1,211 @@
+//
+//  thread.c
+//  nflate
+//
+//  Copyright (c) 2020 David Kopec
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200112L // for clock_gettime()
+#endif
+
+#include <stdlib.h>
+#include "thread.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <time.h>
+#endif
+
+// the thread entry points of both APIs take a single pointer, so the function
+// and its argument travel to the new thread together in one of these
+typedef struct {
+    void (*function)(void *);
+    void *argument;
+} thread_start;
+
+#ifdef _WIN32
+
+// function pointers can't portably travel through a PVOID, so pass a pointer to one instead
+typedef struct {
+    void (*function)(void);
+} once_function;
+
+static BOOL CALLBACK run_once(PINIT_ONCE flag, PVOID parameter, PVOID *context) {
+    (void)flag;
+    (void)context;
+    ((once_function *)parameter)->function();
+    return TRUE;
+}
+
+void thread_once(thread_once_flag *flag, void (*function)(void)) {
+    once_function holder = {function};
+    InitOnceExecuteOnce(flag, run_once, &holder, NULL);
+}
+
+static DWORD WINAPI run_thread(LPVOID parameter) {
+    thread_start start = *(thread_start *)parameter;
+    free(parameter);
+    start.function(start.argument);
+    return 0;
+}
+
+bool thread_create(thread_handle *thread, void (*function)(void *), void *argument) {
+    thread_start *start = malloc(sizeof(thread_start));
+    if (start == NULL) {
+        return false;
+    }
+    start->function = function;
+    start->argument = argument;
+    *thread = CreateThread(NULL, 0, run_thread, start, 0, NULL);
+    if (*thread == NULL) {
+        free(start);
+        return false;
+    }
+    return true;
+}
+
+void thread_join(thread_handle thread) {
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+
+void thread_mutex_init(thread_mutex *mutex) {
+    InitializeCriticalSection(mutex);
+}
+
+void thread_mutex_destroy(thread_mutex *mutex) {
+    DeleteCriticalSection(mutex);
+}
+
+void thread_mutex_lock(thread_mutex *mutex) {
+    EnterCriticalSection(mutex);
+}
+
+void thread_mutex_unlock(thread_mutex *mutex) {
+    LeaveCriticalSection(mutex);
+}
+
+void thread_cond_init(thread_cond *cond) {
+    InitializeConditionVariable(cond);
+}
+
+void thread_cond_destroy(thread_cond *cond) {
+    (void)cond; // Windows condition variables hold no resources
+}
+
+void thread_cond_wait(thread_cond *cond, thread_mutex *mutex) {
+    SleepConditionVariableCS(cond, mutex, INFINITE);
+}
+
+void thread_cond_signal(thread_cond *cond) {
+    WakeConditionVariable(cond);
+}
+
+void thread_cond_broadcast(thread_cond *cond) {
+    WakeAllConditionVariable(cond);
+}
+
+int thread_cpu_count(void) {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (info.dwNumberOfProcessors > 0) ? (int)info.dwNumberOfProcessors : 1;
+}
+
+double thread_seconds(void) {
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+}
+
+#else
+
+void thread_once(thread_once_flag *flag, void (*function)(void)) {
+    pthread_once(flag, function);
+}
+
+static void *run_thread(void *parameter) {
+    thread_start start = *(thread_start *)parameter;
+    free(parameter);
+    start.function(start.argument);
+    return NULL;
+}
+
+bool thread_create(thread_handle *thread, void (*function)(void *), void *argument) {
+    thread_start *start = malloc(sizeof(thread_start));
+    if (start == NULL) {
+        return false;
+    }
+    start->function = function;
+    start->argument = argument;
+    if (pthread_create(thread, NULL, run_thread, start) != 0) {
+        free(start);
+        return false;
+    }
+    return true;
+}
+
+void thread_join(thread_handle thread) {
+    pthread_join(thread, NULL);
+}
+
+void thread_mutex_init(thread_mutex *mutex) {
+    pthread_mutex_init(mutex, NULL);
+}
+
+void thread_mutex_destroy(thread_mutex *mutex) {
+    pthread_mutex_destroy(mutex);
+}
+
+void thread_mutex_lock(thread_mutex *mutex) {
+    pthread_mutex_lock(mutex);
+}
+
+void thread_mutex_unlock(thread_mutex *mutex) {
+    pthread_mutex_unlock(mutex);
+}
+
+void thread_cond_init(thread_cond *cond) {
+    pthread_cond_init(cond, NULL);
+}
+
+void thread_cond_destroy(thread_cond *cond) {
+    pthread_cond_destroy(cond);
+}
+
+void thread_cond_wait(thread_cond *cond, thread_mutex *mutex) {
+    pthread_cond_wait(cond, mutex);
+}
+
+void thread_cond_signal(thread_cond *cond) {
+    pthread_cond_signal(cond);
+}
+
+void thread_cond_broadcast(thread_cond *cond) {
+    pthread_cond_broadcast(cond);
+}
+
+int thread_cpu_count(void) {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return (count > 0) ? (int)count : 1;
+}
+
+double thread_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+#endif
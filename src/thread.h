@@ -0,0 +1,73 @@
+//
+//  thread.h
+//  nflate
+//
+//  Copyright (c) 2020 David Kopec
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+// Thin wrappers over POSIX threads and the Windows threading API
+
+#ifndef thread_h
+#define thread_h
+
+#include <stdbool.h>
+
+#ifdef _WIN32
+#include <windows.h>
+typedef INIT_ONCE thread_once_flag;
+#define THREAD_ONCE_INIT INIT_ONCE_STATIC_INIT
+typedef HANDLE thread_handle;
+typedef CRITICAL_SECTION thread_mutex;
+typedef CONDITION_VARIABLE thread_cond;
+#else
+#include <pthread.h>
+typedef pthread_once_t thread_once_flag;
+#define THREAD_ONCE_INIT PTHREAD_ONCE_INIT
+typedef pthread_t thread_handle;
+typedef pthread_mutex_t thread_mutex;
+typedef pthread_cond_t thread_cond;
+#endif
+
+// run *function* exactly once for *flag*, no matter how many threads call this
+// at the same time; every caller returns only after it has finished
+void thread_once(thread_once_flag *flag, void (*function)(void));
+
+// start a thread running *function(argument)*
+// returns false if the thread couldn't be started
+bool thread_create(thread_handle *thread, void (*function)(void *), void *argument);
+
+// wait for *thread* to finish and release it
+void thread_join(thread_handle thread);
+
+void thread_mutex_init(thread_mutex *mutex);
+void thread_mutex_destroy(thread_mutex *mutex);
+void thread_mutex_lock(thread_mutex *mutex);
+void thread_mutex_unlock(thread_mutex *mutex);
+
+void thread_cond_init(thread_cond *cond);
+void thread_cond_destroy(thread_cond *cond);
+// atomically unlock *mutex* and sleep until *cond* is signaled, then lock *mutex* again
+// may wake up spuriously, so always wait in a loop that checks the condition
+void thread_cond_wait(thread_cond *cond, thread_mutex *mutex);
+void thread_cond_signal(thread_cond *cond);
+void thread_cond_broadcast(thread_cond *cond);
+
+// number of processors available to run threads on, at least 1
+int thread_cpu_count(void);
+
+// seconds since some fixed point in the past, from a clock that only ever
+// moves forward, for timing things
+double thread_seconds(void);
+
+#endif /* thread_h */
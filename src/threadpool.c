@@ -0,0 +1,146 @@
+//
+//  threadpool.c
+//  nflate
+//
+//  Copyright (c) 2020 David Kopec
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include "threadpool.h"
+#include "thread.h"
+
+struct threadpool_task {
+    void (*function)(void *);
+    void *argument;
+    bool done;
+    threadpool_task *next; // next task in the queue
+};
+
+struct threadpool {
+    thread_mutex lock; // guards everything below
+    thread_cond work_ready; // signaled when a task is queued or the pool is stopping
+    thread_cond work_done; // broadcast whenever a task finishes
+    threadpool_task *head; // tasks not yet picked up by a worker, oldest first
+    threadpool_task *tail;
+    bool stopping;
+    int num_threads;
+    thread_handle *threads;
+};
+
+static void work(void *argument) {
+    threadpool *pool = argument;
+    thread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (pool->head == NULL && !pool->stopping) {
+            thread_cond_wait(&pool->work_ready, &pool->lock);
+        }
+        if (pool->head == NULL) {
+            break; // stopping and nothing left to run
+        }
+        threadpool_task *task = pool->head;
+        pool->head = task->next;
+        if (pool->head == NULL) {
+            pool->tail = NULL;
+        }
+
+        thread_mutex_unlock(&pool->lock);
+        task->function(task->argument);
+        thread_mutex_lock(&pool->lock);
+
+        task->done = true;
+        thread_cond_broadcast(&pool->work_done);
+    }
+    thread_mutex_unlock(&pool->lock);
+}
+
+threadpool *threadpool_create(int num_threads) {
+    if (num_threads < 1) {
+        num_threads = 1;
+    }
+    threadpool *pool = calloc(1, sizeof(threadpool));
+    if (pool == NULL) {
+        return NULL;
+    }
+    pool->threads = malloc(num_threads * sizeof(thread_handle));
+    if (pool->threads == NULL) {
+        free(pool);
+        return NULL;
+    }
+    thread_mutex_init(&pool->lock);
+    thread_cond_init(&pool->work_ready);
+    thread_cond_init(&pool->work_done);
+    for (int i = 0; i < num_threads; i++) {
+        if (!thread_create(&pool->threads[i], work, pool)) {
+            fprintf(stderr, "Error starting worker thread.\n");
+            break;
+        }
+        pool->num_threads++;
+    }
+    if (pool->num_threads == 0) {
+        threadpool_free(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+threadpool_task *threadpool_submit(threadpool *pool, void (*function)(void *), void *argument) {
+    threadpool_task *task = malloc(sizeof(threadpool_task));
+    if (task == NULL) {
+        return NULL;
+    }
+    task->function = function;
+    task->argument = argument;
+    task->done = false;
+    task->next = NULL;
+
+    thread_mutex_lock(&pool->lock);
+    if (pool->tail != NULL) {
+        pool->tail->next = task;
+    } else {
+        pool->head = task;
+    }
+    pool->tail = task;
+    thread_cond_signal(&pool->work_ready);
+    thread_mutex_unlock(&pool->lock);
+    return task;
+}
+
+void threadpool_join(threadpool *pool, threadpool_task *task) {
+    thread_mutex_lock(&pool->lock);
+    while (!task->done) {
+        thread_cond_wait(&pool->work_done, &pool->lock);
+    }
+    thread_mutex_unlock(&pool->lock);
+    free(task);
+}
+
+void threadpool_free(threadpool *pool) {
+    if (pool == NULL) {
+        return;
+    }
+    thread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    thread_cond_broadcast(&pool->work_ready);
+    thread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->num_threads; i++) {
+        thread_join(pool->threads[i]);
+    }
+    thread_cond_destroy(&pool->work_done);
+    thread_cond_destroy(&pool->work_ready);
+    thread_mutex_destroy(&pool->lock);
+    free(pool->threads);
+    free(pool);
+}
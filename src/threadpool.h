@@ -0,0 +1,42 @@
+//
+//  threadpool.h
+//  nflate
+//
+//  Copyright (c) 2020 David Kopec
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+// A fixed set of worker threads that run tasks in the order they are submitted
+
+#ifndef threadpool_h
+#define threadpool_h
+
+typedef struct threadpool threadpool;
+typedef struct threadpool_task threadpool_task;
+
+// start a pool of *num_threads* worker threads
+// returns NULL if the pool couldn't be set up
+threadpool *threadpool_create(int num_threads);
+
+// queue up *function(argument)* to be run by the next free worker
+// every task that is submitted must be joined with threadpool_join()
+// returns NULL if out of memory
+threadpool_task *threadpool_submit(threadpool *pool, void (*function)(void *), void *argument);
+
+// wait until *task* has finished running, then free it
+void threadpool_join(threadpool *pool, threadpool_task *task);
+
+// stop the workers once they have run every queued task and free the pool
+void threadpool_free(threadpool *pool);
+
+#endif /* threadpool_h */
@@ -0,0 +1,255 @@
+//
+//  writer.c
+//  nflate
+//
+//  Copyright (c) 2020 David Kopec
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#ifndef _WIN32
+#define _GNU_SOURCE // for O_DIRECT
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include "writer.h"
+#include "thread.h"
+
+#ifdef _WIN32
+#include <io.h>
+#include <limits.h>
+#include <malloc.h>
+#include <sys/stat.h>
+#define STDOUT_FILENO 1
+#else
+#include <unistd.h>
+#endif
+
+#define WRITER_BUFFER_SIZE (1 << 22)
+#define WRITER_ALIGNMENT 4096 // O_DIRECT needs buffers, sizes and file offsets aligned to the block size
+
+struct writer {
+    int file;
+    bool direct; // the file was opened with O_DIRECT
+    bool failed;
+    uint8_t *buffers[2]; // one fills while the other is written in the background
+    int filling; // index of the buffer being filled
+    size_t filled;
+
+    // only used with a background thread
+    bool background;
+    thread_handle thread;
+    thread_mutex lock; // guards everything below
+    thread_cond changed;
+    size_t pending; // bytes of the other buffer waiting to be written, 0 once it is free
+    bool stopping;
+};
+
+static uint8_t *allocate_aligned(size_t size) {
+#ifdef _WIN32
+    return _aligned_malloc(size, WRITER_ALIGNMENT);
+#else
+    void *memory = NULL;
+    if (posix_memalign(&memory, WRITER_ALIGNMENT, size) != 0) {
+        return NULL;
+    }
+    return memory;
+#endif
+}
+
+static void free_aligned(uint8_t *memory) {
+#ifdef _WIN32
+    _aligned_free(memory);
+#else
+    free(memory);
+#endif
+}
+
+// write all of *data*, retrying short writes
+static bool write_all(writer *w, const uint8_t *data, size_t length) {
+#ifndef _WIN32
+    if (w->direct && length % WRITER_ALIGNMENT != 0) {
+        // only the last piece of the file can be unaligned, so finish without O_DIRECT
+        fcntl(w->file, F_SETFL, fcntl(w->file, F_GETFL) & ~O_DIRECT);
+        w->direct = false;
+    }
+#endif
+    while (length > 0) {
+#ifdef _WIN32
+        unsigned int amount = (length > INT_MAX) ? INT_MAX : (unsigned int)length;
+        int written = _write(w->file, data, amount);
+#else
+        ssize_t written = write(w->file, data, length);
+#endif
+        if (written <= 0) {
+            perror("Error writing to file");
+            return false;
+        }
+        data += written;
+        length -= (size_t)written;
+    }
+    return true;
+}
+
+static void write_in_background(void *argument) {
+    writer *w = argument;
+    thread_mutex_lock(&w->lock);
+    for (;;) {
+        while (w->pending == 0 && !w->stopping) {
+            thread_cond_wait(&w->changed, &w->lock);
+        }
+        if (w->pending == 0) {
+            break;
+        }
+        uint8_t *buffer = w->buffers[1 - w->filling];
+        size_t length = w->pending;
+        thread_mutex_unlock(&w->lock);
+        bool written = write_all(w, buffer, length);
+        thread_mutex_lock(&w->lock);
+        if (!written) {
+            w->failed = true;
+        }
+        w->pending = 0;
+        thread_cond_broadcast(&w->changed);
+    }
+    thread_mutex_unlock(&w->lock);
+}
+
+// hand the buffer being filled off to be written and start filling the other one
+static void flush(writer *w) {
+    if (w->filled == 0) {
+        return;
+    }
+    if (!w->background) {
+        if (!w->failed && !write_all(w, w->buffers[w->filling], w->filled)) {
+            w->failed = true;
+        }
+        w->filled = 0;
+        return;
+    }
+    thread_mutex_lock(&w->lock);
+    while (w->pending != 0) { // wait for the other buffer to be written
+        thread_cond_wait(&w->changed, &w->lock);
+    }
+    w->filling = 1 - w->filling;
+    w->pending = w->filled;
+    thread_cond_broadcast(&w->changed);
+    thread_mutex_unlock(&w->lock);
+    w->filled = 0;
+}
+
+writer *writer_open(const char *name, int flags) {
+    writer *w = calloc(1, sizeof(writer));
+    if (w == NULL) {
+        return NULL;
+    }
+    if (name == NULL) {
+        w->file = STDOUT_FILENO;
+#ifdef _WIN32
+        _setmode(w->file, _O_BINARY);
+#endif
+    } else {
+#ifdef _WIN32
+        w->file = _open(name, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+        w->file = -1;
+#ifdef O_DIRECT
+        if (flags & WRITER_DIRECT) {
+            w->file = open(name, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0666);
+            w->direct = (w->file >= 0);
+        }
+#endif
+        if (w->file < 0) { // not asked for, or the file system doesn't support it
+            w->file = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        }
+#endif
+        if (w->file < 0) {
+            perror("The following error occurred");
+            free(w);
+            return NULL;
+        }
+    }
+
+    w->background = (flags & WRITER_BACKGROUND) != 0;
+    w->buffers[0] = allocate_aligned(WRITER_BUFFER_SIZE);
+    w->buffers[1] = w->background ? allocate_aligned(WRITER_BUFFER_SIZE) : NULL;
+    if (w->buffers[0] == NULL || (w->background && w->buffers[1] == NULL)) {
+        fprintf(stderr, "Error allocating memory for output.\n");
+        w->background = false;
+        writer_close(w);
+        return NULL;
+    }
+    if (w->background) {
+        thread_mutex_init(&w->lock);
+        thread_cond_init(&w->changed);
+        if (!thread_create(&w->thread, write_in_background, w)) {
+            // fall back to writing on the calling thread
+            thread_cond_destroy(&w->changed);
+            thread_mutex_destroy(&w->lock);
+            w->background = false;
+        }
+    }
+    return w;
+}
+
+bool writer_write(writer *w, const uint8_t *data, size_t length) {
+    while (length > 0) {
+        size_t amount = WRITER_BUFFER_SIZE - w->filled;
+        if (amount > length) {
+            amount = length;
+        }
+        memcpy(w->buffers[w->filling] + w->filled, data, amount);
+        w->filled += amount;
+        data += amount;
+        length -= amount;
+        if (w->filled == WRITER_BUFFER_SIZE) {
+            flush(w);
+        }
+    }
+    if (w->background) {
+        thread_mutex_lock(&w->lock);
+        bool failed = w->failed;
+        thread_mutex_unlock(&w->lock);
+        return !failed;
+    }
+    return !w->failed;
+}
+
+bool writer_close(writer *w) {
+    flush(w);
+    if (w->background) {
+        thread_mutex_lock(&w->lock);
+        w->stopping = true;
+        thread_cond_broadcast(&w->changed);
+        thread_mutex_unlock(&w->lock);
+        thread_join(w->thread);
+        thread_cond_destroy(&w->changed);
+        thread_mutex_destroy(&w->lock);
+    }
+    bool success = !w->failed;
+    if (w->file != STDOUT_FILENO) {
+#ifdef _WIN32
+        if (_close(w->file) != 0) {
+#else
+        if (close(w->file) != 0) {
+#endif
+            success = false;
+        }
+    }
+    free_aligned(w->buffers[0]);
+    free_aligned(w->buffers[1]);
+    free(w);
+    return success;
+}
@@ -0,0 +1,50 @@
+//
+//  writer.h
+//  nflate
+//
+//  Copyright (c) 2020 David Kopec
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+// Buffered output for decompressed data
+// Output is collected into large, page-aligned buffers and written a whole
+// buffer at a time. Optionally a background thread does the writing while the
+// next buffer fills, so decoding and disk I/O overlap.
+
+#ifndef writer_h
+#define writer_h
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define WRITER_BACKGROUND 1 // write full buffers on a background thread
+#define WRITER_DIRECT 2 // bypass the page cache with O_DIRECT where it is supported
+
+typedef struct writer writer;
+
+// create or truncate the file *name* for writing, or write to standard output
+// if *name* is NULL
+// *flags* is a combination of the WRITER_ flags above, or 0
+// returns NULL if the file can't be opened
+writer *writer_open(const char *name, int flags);
+
+// add *length* bytes of *data* to the output
+// returns false if an earlier write failed
+bool writer_write(writer *w, const uint8_t *data, size_t length);
+
+// write out everything still buffered, close the file and free *w*
+// returns false if any write failed
+bool writer_close(writer *w);
+
+#endif /* writer_h */
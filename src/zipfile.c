@@ -0,0 +1,423 @@
+//
+//  zipfile.c
+//  nflate
+//
+//  Copyright (c) 2020 David Kopec
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+#ifndef _WIN32
+#define _DEFAULT_SOURCE // for mkdir()
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "zipfile.h"
+#include "crc32.h"
+#include "thread.h"
+#include "threadpool.h"
+
+#ifdef _WIN32
+#include <direct.h>
+#define make_directory(name) _mkdir(name)
+#else
+#include <sys/stat.h>
+#define make_directory(name) mkdir(name, 0777)
+#endif
+
+// record signatures and fixed lengths (APPNOTE 4.3)
+#define LOCAL_HEADER_SIGNATURE 0x04034b50
+#define LOCAL_HEADER_LENGTH 30
+#define CENTRAL_HEADER_SIGNATURE 0x02014b50
+#define CENTRAL_HEADER_LENGTH 46
+#define END_SIGNATURE 0x06054b50
+#define END_LENGTH 22
+#define ZIP64_LOCATOR_SIGNATURE 0x07064b50
+#define ZIP64_LOCATOR_LENGTH 20
+#define ZIP64_END_SIGNATURE 0x06064b50
+#define ZIP64_END_LENGTH 56
+#define ZIP64_EXTRA_ID 0x0001
+#define MAX_COMMENT_LENGTH 65535
+#define FLAG_ENCRYPTED 1
+
+static uint16_t read_le16(const uint8_t *data) {
+    return (uint16_t)(data[0] | (data[1] << 8));
+}
+
+static uint64_t read_le64(const uint8_t *data) {
+    return (uint64_t)gzip_read_le32(data) | ((uint64_t)gzip_read_le32(data + 4) << 32);
+}
+
+bool zip_detect(const uint8_t *data, size_t length) {
+    // an archive starts with its first entry, or is empty and starts with the end record
+    return length >= 4 && (gzip_read_le32(data) == LOCAL_HEADER_SIGNATURE || gzip_read_le32(data) == END_SIGNATURE);
+}
+
+// the end of central directory record is the last thing in the archive but for
+// a comment of up to 64 KB, so look for it backwards from the end
+// returns its offset, or length if there isn't one
+static size_t find_end_record(const uint8_t *data, size_t length) {
+    if (length < END_LENGTH) {
+        return length;
+    }
+    size_t lowest = (length - END_LENGTH > MAX_COMMENT_LENGTH) ? length - END_LENGTH - MAX_COMMENT_LENGTH : 0;
+    for (size_t offset = length - END_LENGTH + 1; offset-- > lowest;) {
+        if (gzip_read_le32(data + offset) == END_SIGNATURE &&
+            offset + END_LENGTH + read_le16(data + offset + 20) == length) {
+            return offset;
+        }
+    }
+    return length;
+}
+
+// fields too big for the end record are 0xFFFF or 0xFFFFFFFF there, and held
+// in the ZIP64 end record instead, found through the locator right before it
+static bool read_zip64_end(const uint8_t *data, size_t end_offset, uint64_t *num_entries, uint64_t *directory_length,
+                           uint64_t *directory_offset) {
+    if (end_offset < ZIP64_LOCATOR_LENGTH + ZIP64_END_LENGTH) {
+        return false;
+    }
+    const uint8_t *locator = data + end_offset - ZIP64_LOCATOR_LENGTH;
+    if (gzip_read_le32(locator) != ZIP64_LOCATOR_SIGNATURE) {
+        return false;
+    }
+    uint64_t record_offset = read_le64(locator + 8);
+    if (record_offset > end_offset - ZIP64_LOCATOR_LENGTH - ZIP64_END_LENGTH) {
+        return false;
+    }
+    const uint8_t *record = data + record_offset;
+    if (gzip_read_le32(record) != ZIP64_END_SIGNATURE) {
+        return false;
+    }
+    *num_entries = read_le64(record + 32);
+    *directory_length = read_le64(record + 40);
+    *directory_offset = read_le64(record + 48);
+    return true;
+}
+
+// fill in the sizes and offset that didn't fit in 32 bits from the ZIP64
+// extended information in the *extra_length* bytes of *extra*, where they
+// appear in this order, but only the ones that didn't fit (APPNOTE 4.5.3)
+static bool read_zip64_extra(const uint8_t *extra, size_t extra_length, zip_entry *entry) {
+    size_t i = 0;
+    while (extra_length - i >= 4) {
+        uint16_t id = read_le16(extra + i);
+        size_t size = read_le16(extra + i + 2);
+        i += 4;
+        if (size > extra_length - i) {
+            return false;
+        }
+        if (id == ZIP64_EXTRA_ID) {
+            uint64_t *fields[3] = {&entry->uncompressed_size, &entry->compressed_size, &entry->local_header_offset};
+            size_t used = 0;
+            for (int f = 0; f < 3; f++) {
+                if (*fields[f] == 0xFFFFFFFF) {
+                    if (size - used < 8) {
+                        return false;
+                    }
+                    *fields[f] = read_le64(extra + i + used);
+                    used += 8;
+                }
+            }
+            return true;
+        }
+        i += size;
+    }
+    return true;
+}
+
+// read the central directory, which lists every entry
+static bool read_directory(zipfile *zip) {
+    const uint8_t *data = zip->file->contents;
+    size_t length = zip->file->contents_length;
+    size_t end_offset = find_end_record(data, length);
+    if (end_offset == length) {
+        fprintf(stderr, "Couldn't find the end of the central directory.\n");
+        return false;
+    }
+    const uint8_t *end = data + end_offset;
+    uint64_t num_entries = read_le16(end + 10);
+    uint64_t directory_length = gzip_read_le32(end + 12);
+    uint64_t directory_offset = gzip_read_le32(end + 16);
+    if (num_entries == 0xFFFF || directory_length == 0xFFFFFFFF || directory_offset == 0xFFFFFFFF) {
+        if (!read_zip64_end(data, end_offset, &num_entries, &directory_length, &directory_offset)) {
+            fprintf(stderr, "Invalid ZIP64 end of central directory.\n");
+            return false;
+        }
+    }
+    if (directory_offset > end_offset || directory_length > end_offset - directory_offset ||
+        num_entries > directory_length / CENTRAL_HEADER_LENGTH) {
+        fprintf(stderr, "Invalid central directory.\n");
+        return false;
+    }
+
+    zip->entries = calloc((num_entries > 0) ? (size_t)num_entries : 1, sizeof(zip_entry));
+    if (zip->entries == NULL) {
+        fprintf(stderr, "Error allocating memory for the central directory.\n");
+        return false;
+    }
+    const uint8_t *header = data + directory_offset;
+    const uint8_t *directory_end = header + directory_length;
+    for (uint64_t i = 0; i < num_entries; i++) {
+        if (directory_end - header < CENTRAL_HEADER_LENGTH || gzip_read_le32(header) != CENTRAL_HEADER_SIGNATURE) {
+            fprintf(stderr, "Invalid central directory entry.\n");
+            return false;
+        }
+        size_t name_length = read_le16(header + 28);
+        size_t extra_length = read_le16(header + 30);
+        size_t comment_length = read_le16(header + 32);
+        size_t record_length = CENTRAL_HEADER_LENGTH + name_length + extra_length + comment_length;
+        if ((size_t)(directory_end - header) < record_length) {
+            fprintf(stderr, "Invalid central directory entry.\n");
+            return false;
+        }
+        zip_entry *entry = &zip->entries[zip->num_entries];
+        entry->flags = read_le16(header + 8);
+        entry->method = read_le16(header + 10);
+        entry->crc32 = gzip_read_le32(header + 16);
+        entry->compressed_size = gzip_read_le32(header + 20);
+        entry->uncompressed_size = gzip_read_le32(header + 24);
+        entry->local_header_offset = gzip_read_le32(header + 42);
+        entry->name = malloc(name_length + 1);
+        if (entry->name == NULL) {
+            fprintf(stderr, "Error allocating memory for the central directory.\n");
+            return false;
+        }
+        memcpy(entry->name, header + CENTRAL_HEADER_LENGTH, name_length);
+        entry->name[name_length] = '\0';
+        zip->num_entries++;
+        if (!read_zip64_extra(header + CENTRAL_HEADER_LENGTH + name_length, extra_length, entry)) {
+            fprintf(stderr, "Invalid ZIP64 extra field for %s.\n", entry->name);
+            return false;
+        }
+        header += record_length;
+    }
+    return true;
+}
+
+zipfile *zip_open(gzipfile *file) {
+    zipfile *zip = calloc(1, sizeof(zipfile));
+    if (zip == NULL) {
+        free_gzfipfile(file);
+        return NULL;
+    }
+    zip->file = file;
+    if (!read_directory(zip)) {
+        free_zipfile(zip);
+        return NULL;
+    }
+    return zip;
+}
+
+zipfile *read_zipfile(const char *name) {
+    gzipfile *file = read_plain_file(name);
+    return (file != NULL) ? zip_open(file) : NULL;
+}
+
+void free_zipfile(zipfile *zip) {
+    if (zip == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < zip->num_entries; i++) {
+        free(zip->entries[i].name);
+    }
+    free(zip->entries);
+    if (zip->file != NULL) {
+        free_gzfipfile(zip->file);
+    }
+    free(zip);
+}
+
+bool zip_name_safe(const char *name) {
+    if (name[0] == '\0' || name[0] == '/' || name[0] == '\\' || strchr(name, ':') != NULL) {
+        return false; // absolute, or a drive letter on Windows
+    }
+    // no component may be .., with either kind of slash between them
+    const char *component = name;
+    for (const char *c = name;; c++) {
+        if (*c == '/' || *c == '\\' || *c == '\0') {
+            if (c - component == 2 && component[0] == '.' && component[1] == '.') {
+                return false;
+            }
+            if (*c == '\0') {
+                return true;
+            }
+            component = c + 1;
+        }
+    }
+}
+
+// where the compressed data of *entry* starts, after its local header, whose
+// name and extra field can differ in length from the central directory's
+// returns NULL if the local header is invalid or the data runs past the end
+static uint8_t *entry_data(const zipfile *zip, const zip_entry *entry) {
+    size_t length = zip->file->contents_length;
+    if (entry->local_header_offset > length || length - entry->local_header_offset < LOCAL_HEADER_LENGTH) {
+        return NULL;
+    }
+    uint8_t *header = zip->file->contents + entry->local_header_offset;
+    if (gzip_read_le32(header) != LOCAL_HEADER_SIGNATURE) {
+        return NULL;
+    }
+    uint64_t start = entry->local_header_offset + LOCAL_HEADER_LENGTH + read_le16(header + 26) + read_le16(header + 28);
+    if (start > length || entry->compressed_size > length - start) {
+        return NULL;
+    }
+    return zip->file->contents + start;
+}
+
+bool zip_extract_entry(const zipfile *zip, const zip_entry *entry, nflate_context *context, uint8_t *dest) {
+    uint8_t *data = entry_data(zip, entry);
+    if (data == NULL || (entry->flags & FLAG_ENCRYPTED)) {
+        return false;
+    }
+    size_t length = (size_t)entry->uncompressed_size;
+    if (entry->method == ZIP_STORED) {
+        if (entry->compressed_size != entry->uncompressed_size) {
+            return false;
+        }
+        memcpy(dest, data, length);
+        return crc32_final(crc32_update(crc32_init(), dest, length)) == entry->crc32;
+    } else if (entry->method == ZIP_DEFLATED) {
+        // the CRC is computed while inflating rather than in a second pass over dest
+        size_t produced;
+        uint32_t crc;
+        nflate_status status = nflate_context_into(context, data, (size_t)entry->compressed_size, dest, length, &produced,
+                                                   NULL, &crc);
+        return status == NFLATE_DONE && produced == length && crc == entry->crc32;
+    }
+    return false;
+}
+
+// Extracting to files
+
+// create the directories *path* needs, up to but not including its last component
+static void make_parent_directories(char *path, size_t directory_length) {
+    for (char *c = path + directory_length + 1; *c != '\0'; c++) {
+        if (*c == '/' || *c == '\\') {
+            char slash = *c;
+            *c = '\0';
+            make_directory(path); // already existing, perhaps made by another thread, is fine
+            *c = slash;
+        }
+    }
+}
+
+// extract *entry* into the file of the same name under *directory*
+static bool extract_to_file(const zipfile *zip, const zip_entry *entry, const char *directory, nflate_context *context) {
+    if (!zip_name_safe(entry->name)) {
+        fprintf(stderr, "Refusing to extract %s outside of %s.\n", entry->name, directory);
+        return false;
+    }
+    size_t directory_length = strlen(directory);
+    size_t name_length = strlen(entry->name);
+    char *path = malloc(directory_length + name_length + 2);
+    if (path == NULL) {
+        fprintf(stderr, "Error allocating memory for %s.\n", entry->name);
+        return false;
+    }
+    memcpy(path, directory, directory_length);
+    path[directory_length] = '/';
+    memcpy(path + directory_length + 1, entry->name, name_length + 1);
+    make_parent_directories(path, directory_length);
+
+    bool extracted = false;
+    if (name_length > 0 && entry->name[name_length - 1] == '/') { // a directory
+        extracted = (make_directory(path) == 0 || errno == EEXIST);
+    } else if (entry->uncompressed_size > (size_t)-1) {
+        fprintf(stderr, "%s is too big to extract.\n", entry->name);
+    } else {
+        uint8_t *contents = malloc((entry->uncompressed_size > 0) ? (size_t)entry->uncompressed_size : 1);
+        if (contents == NULL) {
+            fprintf(stderr, "Error allocating memory for %s.\n", entry->name);
+        } else if (!zip_extract_entry(zip, entry, context, contents)) {
+            fprintf(stderr, "Couldn't extract %s.\n", entry->name);
+        } else {
+            FILE *file = fopen(path, "wb");
+            extracted = (file != NULL) && fwrite(contents, 1, (size_t)entry->uncompressed_size, file) == entry->uncompressed_size;
+            if (file != NULL && fclose(file) != 0) {
+                extracted = false;
+            }
+            if (!extracted) {
+                fprintf(stderr, "Couldn't write %s.\n", path);
+            }
+        }
+        free(contents);
+    }
+    free(path);
+    return extracted;
+}
+
+typedef struct {
+    const zipfile *zip;
+    const char *directory;
+    thread_mutex mutex; // guards next and failed
+    size_t next; // the next entry no thread has started on
+    bool failed;
+} extract_job;
+
+static void extract_entries(void *argument) {
+    extract_job *job = argument;
+    nflate_context *context = nflate_context_create();
+    for (;;) {
+        thread_mutex_lock(&job->mutex);
+        size_t i = job->next;
+        if (context == NULL) {
+            job->failed = true; // the other threads will extract the rest
+        } else if (i < job->zip->num_entries) {
+            job->next++;
+        }
+        thread_mutex_unlock(&job->mutex);
+        if (context == NULL || i >= job->zip->num_entries) {
+            break;
+        }
+        if (!extract_to_file(job->zip, &job->zip->entries[i], job->directory, context)) {
+            thread_mutex_lock(&job->mutex);
+            job->failed = true;
+            thread_mutex_unlock(&job->mutex);
+        }
+    }
+    nflate_context_free(context);
+}
+
+bool zip_extract_all(const zipfile *zip, const char *directory, int num_threads) {
+    extract_job job = {.zip = zip, .directory = directory};
+    thread_mutex_init(&job.mutex);
+    if (make_directory(directory) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Couldn't create %s.\n", directory);
+        thread_mutex_destroy(&job.mutex);
+        return false;
+    }
+    // the calling thread works on entries too
+    threadpool *pool = (num_threads > 1) ? threadpool_create(num_threads - 1) : NULL;
+    threadpool_task **tasks = (pool != NULL) ? calloc((size_t)num_threads - 1, sizeof(threadpool_task *)) : NULL;
+    if (tasks != NULL) {
+        for (int i = 0; i < num_threads - 1; i++) {
+            tasks[i] = threadpool_submit(pool, extract_entries, &job);
+        }
+    }
+    extract_entries(&job);
+    if (tasks != NULL) {
+        for (int i = 0; i < num_threads - 1; i++) {
+            if (tasks[i] != NULL) {
+                threadpool_join(pool, tasks[i]);
+            }
+        }
+        free(tasks);
+    }
+    threadpool_free(pool);
+    thread_mutex_destroy(&job.mutex);
+    return !job.failed;
+}
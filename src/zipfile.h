@@ -0,0 +1,87 @@
+//
+//  zipfile.h
+//  nflate
+//
+//  Copyright (c) 2020 David Kopec
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+// Reading ZIP archives, including ZIP64 ones for archives past 4 GB or 65535
+// entries, as described in PKWARE's APPNOTE.TXT
+// https://pkware.cachefly.net/webdocs/casestudies/APPNOTE.TXT
+// Every entry is compressed on its own, so entries can be extracted on
+// several threads at once, each with its own decoding context.
+
+#ifndef zipfile_h
+#define zipfile_h
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "gzipfile.h"
+#include "nflate.h"
+
+#define ZIP_STORED 0
+#define ZIP_DEFLATED 8
+
+// an entry as the central directory describes it
+typedef struct {
+    char *name; // with / between directories; directories end in /
+    uint16_t flags;
+    uint16_t method; // ZIP_STORED or ZIP_DEFLATED are the ones that can be extracted
+    uint32_t crc32;
+    uint64_t compressed_size;
+    uint64_t uncompressed_size;
+    uint64_t local_header_offset;
+} zip_entry;
+
+typedef struct {
+    gzipfile *file; // all of the archive, mapped into memory if possible
+    size_t num_entries;
+    zip_entry *entries; // in central directory order
+} zipfile;
+
+// does *data*, which is *length* bytes long, look like the start of a ZIP archive?
+bool zip_detect(const uint8_t *data, size_t length);
+
+// read the central directory of the archive in *file*, as read by
+// read_plain_file(); *file* is freed along with the zipfile, or right away if
+// it isn't a valid archive
+// returns NULL if it isn't a valid archive
+zipfile *zip_open(gzipfile *file);
+
+// read the archive *name* and its central directory
+// returns NULL if it can't be read or isn't a valid archive
+zipfile *read_zipfile(const char *name);
+
+void free_zipfile(zipfile *zip);
+
+// is *name* safe to create under the directory an archive is extracted to?
+// names that are absolute or climb out of it with .. aren't ("zip slip")
+bool zip_name_safe(const char *name);
+
+// extract *entry* into *dest*, which has room for entry->uncompressed_size
+// bytes, checking its size and CRC-32
+// *context* is used to inflate deflated entries
+// nothing is printed if it can't be extracted
+// returns false if the entry is invalid, encrypted or compressed some other way
+bool zip_extract_entry(const zipfile *zip, const zip_entry *entry, nflate_context *context, uint8_t *dest);
+
+// extract every entry of *zip* into files under *directory*, on up to
+// *num_threads* threads; each thread takes the next entry not yet started, so
+// a few big entries don't hold up the rest
+// entries with unsafe names are refused
+// returns false if any entry couldn't be extracted
+bool zip_extract_all(const zipfile *zip, const char *directory, int num_threads);
+
+#endif /* zipfile_h */
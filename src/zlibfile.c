@@ -0,0 +1,114 @@
+//
+//  zlibfile.c
+//  nflate
+//
+//  Copyright (c) 2020 David Kopec
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+// Based on RFC 1950
+// https://tools.ietf.org/html/rfc1950
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "zlibfile.h"
+#include "nflate.h"
+#include "adler32.h"
+
+#define CM_DEFLATE 8
+#define MAX_CINFO 7 // a window of 2^(7 + 8) = 32 KB
+#define FDICT 0x20
+#define ID1_GZIP 31
+#define ID2_GZIP 139
+
+// multi-byte zlib fields are big-endian, unlike gzip's
+static uint32_t read_be32(const uint8_t *data) {
+    return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | (uint32_t)data[3];
+}
+
+container_type detect_container(const uint8_t *data, size_t length) {
+    if (length >= 2 && data[0] == ID1_GZIP && data[1] == ID2_GZIP) {
+        return CONTAINER_GZIP;
+    }
+    uint32_t DICTID;
+    if (zlib_header_length(data, length, &DICTID) > 0) {
+        return CONTAINER_ZLIB;
+    }
+    return CONTAINER_RAW;
+}
+
+size_t zlib_header_length(const uint8_t *data, size_t length, uint32_t *DICTID) {
+    *DICTID = 0;
+    if (length < 2) {
+        return 0;
+    }
+    uint8_t CMF = data[0]; // names come from RFC 1950
+    uint8_t FLG = data[1];
+    // FCHECK makes the first two bytes a multiple of 31
+    if ((CMF & 0x0F) != CM_DEFLATE || (CMF >> 4) > MAX_CINFO || ((CMF << 8) | FLG) % 31 != 0) {
+        return 0;
+    }
+    if (!(FLG & FDICT)) {
+        return 2;
+    }
+    if (length < 6) {
+        return 0;
+    }
+    *DICTID = read_be32(data + 2);
+    return 6;
+}
+
+uint8_t *inflate_zlib(uint8_t *data, size_t length, const uint8_t *dictionary, size_t dictionary_length,
+                      size_t *result_length, size_t *consumed) {
+    uint32_t DICTID;
+    size_t header_length = zlib_header_length(data, length, &DICTID);
+    if (header_length == 0) {
+        fprintf(stderr, "Not a valid zlib header.\n");
+        return NULL;
+    }
+    if (header_length == 6) {
+        if (dictionary == NULL) {
+            fprintf(stderr, "The data needs a preset dictionary with Adler-32 %08x.\n", DICTID);
+            return NULL;
+        }
+        if (adler32_update(adler32_init(), dictionary, dictionary_length) != DICTID) {
+            fprintf(stderr, "The dictionary isn't the one the data needs.\n");
+            return NULL;
+        }
+    } else {
+        dictionary_length = 0; // a stream that doesn't ask for one can't refer to one
+    }
+
+    size_t deflate_length = 0;
+    uint8_t *result = nflate_with_dictionary(data + header_length, length - header_length, dictionary, dictionary_length, 0,
+                                             result_length, &deflate_length);
+    if (result == NULL) {
+        fprintf(stderr, "Couldn't inflate zlib data.\n");
+        return NULL;
+    }
+    size_t trailer = header_length + deflate_length;
+    if (length - trailer < ZLIB_TRAILER_LENGTH) {
+        fprintf(stderr, "Unexpectedly found EOF while reading the Adler-32.\n");
+        free(result);
+        return NULL;
+    }
+    if (adler32_update(adler32_init(), result, *result_length) != read_be32(data + trailer)) {
+        fprintf(stderr, "Adler-32 check failed.\n");
+        free(result);
+        return NULL;
+    }
+    if (consumed != NULL) {
+        *consumed = trailer + ZLIB_TRAILER_LENGTH;
+    }
+    return result;
+}
@@ -0,0 +1,59 @@
+//
+//  zlibfile.h
+//  nflate
+//
+//  Copyright (c) 2020 David Kopec
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+
+// Based on RFC 1950
+// https://tools.ietf.org/html/rfc1950
+// DEFLATE data comes wrapped in a gzip member, in a zlib stream (HTTP's
+// deflate encoding, PNG and Git objects), or bare with no wrapper at all.
+
+#ifndef zlibfile_h
+#define zlibfile_h
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+typedef enum {
+    CONTAINER_GZIP,
+    CONTAINER_ZLIB,
+    CONTAINER_RAW // DEFLATE data with no header or trailer
+} container_type;
+
+// tell from its first bytes what *data*, which is *length* bytes long, is wrapped in
+// anything that doesn't start with a gzip or zlib header is taken to be raw DEFLATE data
+container_type detect_container(const uint8_t *data, size_t length);
+
+#define ZLIB_TRAILER_LENGTH 4
+
+// length of the zlib header at the start of *data*, which is 2 bytes, or 6 if
+// the stream needs a preset dictionary
+// *DICTID* is a pointer to a place to hold the Adler-32 of that dictionary, or 0 if there is none
+// returns 0 if *data* doesn't start with a valid header
+size_t zlib_header_length(const uint8_t *data, size_t length, uint32_t *DICTID);
+
+// inflate the zlib stream at the start of *data* and check its Adler-32
+// *dictionary* holds the *dictionary_length* bytes of the preset dictionary,
+// for streams that need one, or is NULL
+// *result_length* is a pointer to a place to hold the length of the uncompressed data
+// *consumed* is a pointer to a place to hold how many bytes the stream took up, or NULL
+// returns the uncompressed data, or NULL if it couldn't be inflated, the
+// dictionary is missing or isn't the one asked for, or the Adler-32 doesn't match
+uint8_t *inflate_zlib(uint8_t *data, size_t length, const uint8_t *dictionary, size_t dictionary_length,
+                      size_t *result_length, size_t *consumed);
+
+#endif /* zlibfile_h */
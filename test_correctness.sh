@@ -1,8 +1,8 @@
 #!/bin/bash
 
-# return true if both files are the same
+# return true if both files are the same (and both exist)
 the_same () {
-	[ -z "$(diff -q $1 $2)" ]
+	diff -q "$1" "$2" > /dev/null
 }
 
 make # build the program
@@ -30,5 +30,258 @@ do
 	i=`expr $i + 1` 
 done
 
+# a file made of several members inflates to all of their contents in turn
+cat samples/pandp.txt.gz samples/house.jpg.gz > members.gz
+cat samples/pandp.txt samples/house.jpg > expected
+for threads in 1 4
+do
+	./nflate -p $threads members.gz decompressed
+
+	if the_same expected decompressed
+	then
+		echo "members.gz -p $threads Test Passed"
+	else
+		echo "members.gz -p $threads Test Failed"
+	fi
+
+	rm -f decompressed
+done
+
+rm -f members.gz expected
+
+# a file of two members, the first long enough to get an access point in its
+# middle, read in ranges with and without its index
+for i in 1 2 3 4 5 6 7 8
+do
+	cat samples/pandp.txt
+done > first
+cat first samples/house.jpg > expected_all
+gzip -c first > indexed.gz
+cat samples/house.jpg.gz >> indexed.gz
+first_length=$(wc -c < first)
+
+for index in "without" "with"
+do
+	if [ $index = "with" ]
+	then
+		./nflate -i indexed.gz
+	fi
+
+	# one from the middle of the first member, then one across into the second
+	for range in "5000000 200000" "$(( first_length - 1000 )) 50000"
+	do
+		set -- $range
+		./nflate -r $1 $2 indexed.gz decompressed
+		dd if=expected_all of=expected bs=1 skip=$1 count=$2 2> /dev/null
+
+		if the_same expected decompressed
+		then
+			echo "indexed.gz -r $1 $2 $index index Test Passed"
+		else
+			echo "indexed.gz -r $1 $2 $index index Test Failed"
+		fi
+
+		rm -f expected decompressed
+	done
+done
+
+rm -f first expected_all indexed.gz indexed.gz.idx
+
+# members piped through standard input come out as they arrive
+cat samples/pandp.txt.gz samples/house.jpg.gz | ./nflate -c > decompressed
+cat samples/pandp.txt samples/house.jpg > expected
+
+if the_same expected decompressed
+then
+	echo "piped members Test Passed"
+else
+	echo "piped members Test Failed"
+fi
+
+rm -f expected decompressed
+
+# a member whose CRC-32 doesn't match its trailer has to fail, piped or not
+cp samples/classes.xls.gz bad_crc.gz
+printf '\x00\x00\x00\x00' | dd of=bad_crc.gz bs=1 seek=$(( $(wc -c < bad_crc.gz) - 8 )) conv=notrunc 2> /dev/null
+if ./nflate -c < bad_crc.gz > /dev/null 2>&1 || ./nflate bad_crc.gz decompressed 2> /dev/null
+then
+	echo "bad_crc.gz Test Failed"
+else
+	echo "bad_crc.gz Test Passed"
+fi
+
+rm -f bad_crc.gz decompressed
+
+# a single member of more than 8 MB of compressed data is split into chunks
+# that are inflated on several threads
+for i in $(seq 24)
+do
+	cat samples/pandp.txt samples/house.jpg samples/classes.xls
+done > large
+gzip -c large > large.gz
+for threads in 1 4
+do
+	./nflate -p $threads large.gz decompressed
+
+	if the_same large decompressed
+	then
+		echo "large.gz -p $threads Test Passed"
+	else
+		echo "large.gz -p $threads Test Failed"
+	fi
+
+	rm -f decompressed
+done
+
+rm -f large large.gz
+
+# the benchmark checks what it inflates, on its own and as a batch
+make nflate_bench > /dev/null
+if ./nflate_bench -w 0 -n 1 samples/pandp.txt.gz samples/house.jpg.gz samples/classes.xls.gz > /dev/null
+then
+	echo "nflate_bench Test Passed"
+else
+	echo "nflate_bench Test Failed"
+fi
+
+# compress each original at a few levels, check that gzip accepts the result
+# and that it inflates back to the original
+for level in 0 1 6 9
+do
+	for test_file in "${files[@]}"
+	do
+		original="${test_file%.*}"
+		./nflate -z -$level -c "$original" > compressed.gz
+		./nflate compressed.gz decompressed
+
+		if gzip -t compressed.gz && the_same "$original" decompressed
+		then
+			echo "$original -$level round trip Test Passed"
+		else
+			echo "$original -$level round trip Test Failed"
+		fi
+
+		rm -f compressed.gz decompressed
+	done
+done
+
+# compress something bigger than the 1 MB chunks on several threads
+cat samples/pandp.txt samples/house.jpg samples/pandp.txt samples/classes.xls samples/pandp.txt > large
+./nflate -z -p 4 -c large > compressed.gz
+./nflate compressed.gz decompressed
+
+if gzip -t compressed.gz && the_same large decompressed
+then
+	echo "large -p 4 round trip Test Passed"
+else
+	echo "large -p 4 round trip Test Failed"
+fi
+
+rm -f large compressed.gz decompressed
+
+# zlib streams and raw DEFLATE data are told apart from gzip by their first bytes
+for test_file in "samples/classes.xls.zz" "samples/classes.xls.deflate"
+do
+	./nflate "$test_file" decompressed
+
+	if the_same "${test_file%.*}" decompressed
+	then
+		echo "$test_file Test Passed"
+	else
+		echo "$test_file Test Failed"
+	fi
+
+	rm -f decompressed
+done
+
+# a zlib stream whose Adler-32 doesn't match has to be refused
+head -c -4 samples/classes.xls.zz > bad_adler.zz
+printf '\x00\x00\x00\x00' >> bad_adler.zz
+if ./nflate bad_adler.zz decompressed 2> /dev/null
+then
+	echo "bad_adler.zz Test Failed"
+else
+	echo "bad_adler.zz Test Passed"
+fi
+
+rm -f bad_adler.zz decompressed
+
+# pandp.txt.dict.zz holds the second 32 KB of pandp.txt compressed with the
+# first 32 KB as its preset dictionary
+head -c 32768 samples/pandp.txt > dictionary
+tail -c +32769 samples/pandp.txt | head -c 32768 > expected
+./nflate -D dictionary samples/pandp.txt.dict.zz decompressed
+
+if the_same expected decompressed
+then
+	echo "samples/pandp.txt.dict.zz Test Passed"
+else
+	echo "samples/pandp.txt.dict.zz Test Failed"
+fi
+
+rm -f dictionary expected decompressed
+
+# classes.zip holds classes.xls deflated with ZIP64 sizes and stored as
+# stored/classes.xls, behind a ZIP64 end of central directory, along with
+# ../escaped.txt, which has to be refused rather than written outside
+if ./nflate samples/classes.zip extracted 2> /dev/null || [ -e escaped.txt ]
+then
+	echo "samples/classes.zip ../ Test Failed"
+else
+	echo "samples/classes.zip ../ Test Passed"
+fi
+
+if the_same samples/classes.xls extracted/classes.xls && the_same samples/classes.xls extracted/stored/classes.xls
+then
+	echo "samples/classes.zip Test Passed"
+else
+	echo "samples/classes.zip Test Failed"
+fi
+
+rm -rf extracted escaped.txt
+
+# pandp.txt.bgz is pandp.txt in BGZF blocks of 65280 bytes each
+for threads in 1 4
+do
+	./nflate -p $threads samples/pandp.txt.bgz decompressed
+
+	if the_same samples/pandp.txt decompressed
+	then
+		echo "samples/pandp.txt.bgz -p $threads Test Passed"
+	else
+		echo "samples/pandp.txt.bgz -p $threads Test Failed"
+	fi
+
+	rm -f decompressed
+done
+
+# read from 100 bytes into the second block, which starts one past the first
+# block's BSIZE, on into the blocks after it
+second_block=$(( $(od -An -tu2 -j16 -N2 samples/pandp.txt.bgz) + 1 ))
+./nflate -b $(( (second_block << 16) | 100 )) 100000 samples/pandp.txt.bgz decompressed
+dd if=samples/pandp.txt of=expected bs=1 skip=$(( 65280 + 100 )) count=100000 2> /dev/null
+
+if the_same expected decompressed
+then
+	echo "samples/pandp.txt.bgz -b Test Passed"
+else
+	echo "samples/pandp.txt.bgz -b Test Failed"
+fi
+
+rm -f expected decompressed
+
+# a block whose file name runs into the last 8 bytes, where its trailer
+# should be, isn't a BGZF block
+printf '\x1f\x8b\x08\x0c\x00\x00\x00\x00\x00\xff\x06\x00BC\x02\x00\x19\x00abcdefg\x00' > crafted.bgz
+cat samples/pandp.txt.bgz >> crafted.bgz
+if ./nflate -b 0 10 crafted.bgz decompressed 2> /dev/null
+then
+	echo "crafted.bgz Test Failed"
+else
+	echo "crafted.bgz Test Passed"
+fi
+
+rm -f crafted.bgz decompressed
+
 # delete binary files
 make clean